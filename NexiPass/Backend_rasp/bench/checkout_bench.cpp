@@ -0,0 +1,189 @@
+/* ==================== checkout_bench.cpp ==================== */
+
+// Compares the legacy six-round-trip checkout against Database::closeCard
+// (one prepared statement). Everything runs in a scratch schema, built by
+// the migrator on connect and dropped at the end, so the checkouts never
+// reach the real producttotals or sales history. The connection string must
+// be in key=value form; the scratch search_path is appended to it.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <libpq-fe.h>
+
+#include "Database.h"
+
+using namespace std;
+
+static const char* kScratchSchema = "nexipass_bench";
+
+/* ==================== Helpers ==================== */
+
+static bool execOk(PGconn* pg, const char* sql, int n = 0, const char* const* params = nullptr) {
+    PGresult* res = PQexecParams(pg, sql, n, nullptr, params, nullptr, nullptr, 0);
+    ExecStatusType st = PQresultStatus(res);
+    PQclear(res);
+    return st == PGRES_COMMAND_OK || st == PGRES_TUPLES_OK;
+}
+
+static string firstValue(PGconn* pg, const char* sql) {
+    PGresult* res = PQexec(pg, sql);
+    string v = (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) > 0) ? PQgetvalue(res, 0, 0) : "";
+    PQclear(res);
+    return v;
+}
+
+static string benchCardId(int i) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "BENCH%04d", i);
+    return buf;
+}
+
+/* ==================== Client-Side Checkout Transaction ==================== */
+
+static bool legacyCloseCard(PGconn* pg, const string& card_id) {
+    const char* p[1] = { card_id.c_str() };
+
+    PGresult* res = PQexecParams(pg, "SELECT status FROM opencard WHERE card_id = $1",
+                                 1, nullptr, p, nullptr, nullptr, 0);
+    bool active = PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 1
+                  && PQgetvalue(res, 0, 0)[0] != 'D';
+    PQclear(res);
+    if (!active) return false;
+
+    if (!execOk(pg, "BEGIN")) return false;
+
+    bool ok = execOk(pg,
+        "INSERT INTO producttotals (product_id, employee_id, qty_total, line_total) "
+        "SELECT product_id, employee_id, SUM(qty), SUM(line_total) "
+        "FROM openconsumption WHERE card_id = $1 "
+        "GROUP BY product_id, employee_id "
+        "ON CONFLICT (product_id, employee_id) DO UPDATE SET "
+        "qty_total = producttotals.qty_total + EXCLUDED.qty_total, "
+        "line_total = producttotals.line_total + EXCLUDED.line_total", 1, p)
+        && execOk(pg, "DELETE FROM openconsumption WHERE card_id = $1", 1, p)
+        && execOk(pg, "UPDATE opencard SET status = 'D', phone = 0, total_to_pay = 0 WHERE card_id = $1", 1, p);
+
+    return execOk(pg, ok ? "COMMIT" : "ROLLBACK") && ok;
+}
+
+/* ==================== Fixture ==================== */
+
+static bool prepareCards(Database& db, PGconn* pg, int cards, int lines, int productId, int employeeId) {
+    for (int i = 0; i < cards; ++i) {
+        string id = benchCardId(i);
+        const char* p[1] = { id.c_str() };
+        if (!execOk(pg, "INSERT INTO opencard (card_id, phone, status, total_to_pay) "
+                        "VALUES ($1, 0, 'D', 0) ON CONFLICT (card_id) DO NOTHING", 1, p)) return false;
+        if (!execOk(pg, "UPDATE opencard SET status = 'D' WHERE card_id = $1", 1, p)) return false;
+        if (db.activateCard(id, 911111111) != DbResult::Ok) return false;
+        for (int l = 0; l < lines; ++l) {
+            if (db.registerConsumption(id, productId, employeeId, 1) != DbResult::Ok) return false;
+        }
+    }
+    return true;
+}
+
+static void report(const char* label, vector<double>& us) {
+    sort(us.begin(), us.end());
+    double sum = 0;
+    for (double v : us) sum += v;
+    cout << label << ": n=" << us.size()
+         << " mean=" << (us.empty() ? 0 : sum / us.size()) << "us"
+         << " p50=" << (us.empty() ? 0 : us[us.size() / 2]) << "us"
+         << " p99=" << (us.empty() ? 0 : us[(us.size() * 99) / 100]) << "us\n";
+}
+
+/* ==================== Benchmark ==================== */
+
+static int runBench(const string& connStr, int cards, int lines) {
+    Database db(connStr, 1);
+    if (db.connect() != DbResult::Ok) {
+        cerr << "[FATAL] Failed to connect to database\n";
+        return 1;
+    }
+
+    PGconn* pg = PQconnectdb(connStr.c_str());
+    if (PQstatus(pg) != CONNECTION_OK) {
+        cerr << "[FATAL] Failed to open benchmark connection\n";
+        PQfinish(pg);
+        return 1;
+    }
+
+    string productId = firstValue(pg,
+        "INSERT INTO product (product_name, price_unit) VALUES ('Bench', 1.50) RETURNING product_id");
+    string employeeId = firstValue(pg,
+        "INSERT INTO users (username, password_hash) VALUES ('bench', '-') RETURNING user_id");
+    if (productId.empty() || employeeId.empty()) {
+        cerr << "[FATAL] Failed to seed the scratch schema\n";
+        PQfinish(pg);
+        return 1;
+    }
+    // The catalogue snapshot was loaded before the product existed
+    db.invalidateCatalog();
+
+    cout << "--- Checkout benchmark: " << cards << " cards x " << lines << " lines ---\n";
+
+    vector<double> legacyUs, oneShotUs;
+
+    for (int round = 0; round < 2; ++round) {
+        if (!prepareCards(db, pg, cards, lines, stoi(productId), stoi(employeeId))) {
+            cerr << "[FATAL] Fixture setup failed\n";
+            PQfinish(pg);
+            return 1;
+        }
+
+        for (int i = 0; i < cards; ++i) {
+            string id = benchCardId(i);
+            auto t0 = chrono::steady_clock::now();
+            bool ok = (round == 0) ? legacyCloseCard(pg, id) : (db.closeCard(id) == DbResult::Ok);
+            auto dt = chrono::duration<double, micro>(chrono::steady_clock::now() - t0).count();
+
+            if (!ok) {
+                cerr << "[WARN] Checkout failed for " << id << "\n";
+                continue;
+            }
+            (round == 0 ? legacyUs : oneShotUs).push_back(dt);
+        }
+    }
+
+    report("legacy (6 round trips)", legacyUs);
+    report("closeCard (1 round trip)", oneShotUs);
+
+    PQfinish(pg);
+    return 0;
+}
+
+/* ==================== Main Entry Point ==================== */
+
+int main(int argc, char** argv) {
+    string connStr = (argc > 1) ? argv[1] : "host=localhost port=5432 dbname=Nexipass user=postgres password=1234";
+    int cards = (argc > 2) ? stoi(argv[2]) : 200;
+    int lines = (argc > 3) ? stoi(argv[3]) : 10;
+
+    PGconn* admin = PQconnectdb(connStr.c_str());
+    if (PQstatus(admin) != CONNECTION_OK) {
+        cerr << "[FATAL] Failed to connect to database\n";
+        PQfinish(admin);
+        return 1;
+    }
+
+    string drop = string("DROP SCHEMA IF EXISTS ") + kScratchSchema + " CASCADE";
+    string create = string("CREATE SCHEMA ") + kScratchSchema;
+    if (!execOk(admin, drop.c_str()) || !execOk(admin, create.c_str())) {
+        cerr << "[FATAL] Cannot create schema " << kScratchSchema << ": " << PQerrorMessage(admin);
+        PQfinish(admin);
+        return 1;
+    }
+
+    int rc = runBench(connStr + " options='-c search_path=" + kScratchSchema + "'", cards, lines);
+
+    if (!execOk(admin, drop.c_str())) {
+        cerr << "[WARN] Failed to drop schema " << kScratchSchema << ": " << PQerrorMessage(admin);
+    }
+    PQfinish(admin);
+    return rc;
+}
@@ -9,12 +9,15 @@
 #include <queue>
 #include <condition_variable>
 #include <chrono>
+#include <list>
+#include <memory>
 #include <pthread.h>
 
 #include "httplib.h" 
 #include "Database.h"
 #include "CardService.h"
 #include "FeedbackController.h"
+#include "EventHub.h"
 
 using namespace std;
 
@@ -24,6 +27,7 @@ struct CachedCardState {
     char status = '?';
     double total_pay = 0.0;
     chrono::steady_clock::time_point scan_time;
+    uint64_t seq = 0;           // Increments on every scan; 0 before the first
 };
 
 class ApiController {
@@ -31,6 +35,8 @@ private:
     Database* db_;
     CardService* cardService_;
     FeedbackController* feedback_;
+    EventHub* events_ = nullptr;
+    atomic<size_t> eventStreams_;   // Open /events responses
     
     httplib::Server server_;
     
@@ -43,17 +49,36 @@ private:
     mutex queueMtx_;
     condition_variable queueCv_;
 
+    // POS WebSocket sessions: one reader thread each, plus a scan pusher
+    struct PosSession {
+        int fd = -1;
+        thread th;
+        shared_ptr<atomic<bool>> done;
+    };
+    thread thPos_;
+    int posListenFd_ = -1;
+    mutex posMtx_;
+    list<PosSession> posSessions_;
+
     mutex stateMtx_;
+    condition_variable stateCv_;    // Signalled by the worker on every scan
     CachedCardState latestCardState_;
+    size_t parkedPolls_ = 0;        // /wait_card requests blocked on stateCv_
 
     void nfcThreadFunction();
     void workerThreadFunction();
     void networkThreadFunction();
+    void posAcceptFunction();
+    void posSessionFunction(int fd, shared_ptr<atomic<bool>> done);
+    string posCommand(const string& message);
     void setThreadPriority(pthread_t handle, int priority);
 
 public:
     ApiController(Database* db, CardService* cs, FeedbackController* fb);
     ~ApiController();
+
+    // Scans are published here and /events streams it; set before start()
+    void useEventHub(EventHub* events);
     
     void start();
     void stop();
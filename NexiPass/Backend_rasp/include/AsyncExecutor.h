@@ -0,0 +1,90 @@
+/* ==================== AsyncExecutor.h ==================== */
+
+#ifndef ASYNCEXECUTOR_H
+#define ASYNCEXECUTOR_H
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <string>
+#include <functional>
+#include <chrono>
+#include <libpq-fe.h>
+
+// One event-loop thread multiplexing a set of non-blocking libpq
+// connections with epoll. Jobs are queued from any thread and dispatched to
+// the first idle connection; their completion runs on the loop thread.
+class AsyncExecutor {
+public:
+    struct Job {
+        // Issues the query (PQsendQuery*); returns 1 on success like libpq
+        std::function<int(PGconn*)> send;
+        // Receives the first result of the query, or nullptr if the
+        // connection failed or the executor stopped. Must not block.
+        std::function<void(PGresult*)> done;
+    };
+
+private:
+    struct Slot {
+        PGconn* pg = nullptr;
+        int fd = -1;
+        bool busy = false;
+        bool broken = false;
+        bool wantWrite = false;
+        Job job;
+        PGresult* first = nullptr;
+
+        // Non-blocking PQresetStart/PQresetPoll state while broken
+        bool resetting = false;
+        uint32_t failures = 0;
+        std::chrono::steady_clock::time_point retryAt;
+    };
+
+    std::string connString_;
+    size_t nConns_;
+    std::function<bool(PGconn*)> init_;
+
+    std::vector<Slot> slots_;
+    std::deque<Job> pending_;
+    std::mutex pendingMtx_;
+
+    std::thread loopThread_;
+    std::atomic<bool> running_;
+    std::atomic<size_t> inFlight_;
+    std::atomic<size_t> healthy_;
+    std::atomic<uint64_t> reconnects_;
+    int epollFd_{-1};
+    int wakeFd_{-1};
+
+    void loop();
+    void dispatch();
+    void onReadable(Slot& slot);
+    void onWritable(Slot& slot);
+    void finish(Slot& slot, bool failed);
+    void watch(Slot& slot, bool wantWrite);
+    void markBroken(Slot& slot);
+    void heal();
+    void onResetPoll(Slot& slot);
+    void rewatch(Slot& slot, uint32_t events);
+
+public:
+    AsyncExecutor(std::string connString, size_t connections, std::function<bool(PGconn*)> init);
+    ~AsyncExecutor();
+
+    AsyncExecutor(const AsyncExecutor&) = delete;
+    AsyncExecutor& operator=(const AsyncExecutor&) = delete;
+
+    bool start();
+    void stop();
+    bool isRunning() const { return running_; }
+
+    void submit(Job job);
+    size_t inFlight() const { return inFlight_; }
+    size_t size() const { return nConns_; }
+    size_t healthy() const { return healthy_; }
+    uint64_t reconnects() const { return reconnects_; }
+};
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <chrono>
+#include <random>
+#include <cstdint>
+
+/* ==================== Reconnect Backoff ==================== */
+
+// Full-jitter exponential backoff: a random delay in [base, min(cap, base * 2^n)].
+// Spreads reconnect attempts so terminals recovering from the same Wi-Fi
+// drop do not hammer Postgres in lockstep.
+inline std::chrono::milliseconds backoffDelay(uint32_t failures,
+                                              std::chrono::milliseconds base = std::chrono::milliseconds(500),
+                                              std::chrono::milliseconds cap = std::chrono::milliseconds(30000)) {
+    thread_local std::mt19937 rng{std::random_device{}()};
+
+    int64_t ceiling = base.count();
+    for (uint32_t i = 0; i < failures && ceiling < cap.count(); ++i) ceiling *= 2;
+    if (ceiling > cap.count()) ceiling = cap.count();
+
+    std::uniform_int_distribution<int64_t> dist(base.count(), ceiling);
+    return std::chrono::milliseconds(dist(rng));
+}
+
+#endif
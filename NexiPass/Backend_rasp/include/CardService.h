@@ -4,22 +4,44 @@
 #define CARDSERVICE_H
 
 #include "Database.h"
+#include "CardStore.h"
 #include "FeedbackController.h"
+#include "EventHub.h"
 #include <string>
 
 class CardService {
 private:
     Database* db_;
     FeedbackController* feedback_;
+    CardStore* store_ = nullptr;
+    WriteAck ack_ = WriteAck::Applied;
+    EventHub* events_ = nullptr;
+
+    void publish(EventType type, const std::string& nfc_uid, DbResult result, double amount = 0.0,
+                 int32_t productId = 0, int32_t employeeId = 0, int32_t quantity = 0);
 
 public:
     CardService(Database* database, FeedbackController* feedback);
     ~CardService();
+
+    // Card writes and status reads go through the in-memory store
+    void useCardStore(CardStore* store, WriteAck ack);
+    bool storeStats(CardStoreStatsDTO& out) const;
+    // Every activation, consumption and checkout outcome is published here
+    void useEventHub(EventHub* events);
     
     DbResult activateCard(const std::string& nfc_uid, int phone);
     DbResult addConsumption(const std::string& nfc_uid, int32_t productId, int32_t employeeId, int32_t quantity);
+    // A whole order for one card, applied atomically with a single feedback
+    DbResult addConsumptions(const std::string& nfc_uid, int32_t employeeId, const std::vector<CartLineDTO>& lines,
+                             double& out_total);
     DbResult deactivateCard(const std::string& nfc_uid);
+    DbResult deactivateCard(const std::string& nfc_uid, CheckoutDTO& out_checkout);
+    DbResult getCardState(const std::string& nfc_uid, OpenCardDTO& out_state);
     DbResult getCardSummary(const std::string& nfc_uid, CardSummaryDTO& out_summary);
+    DbResult getCardSummary(const std::string& nfc_uid, CardSummaryView& out_summary);
+    // Change stamp of an in-memory card; false without the store or when not cached
+    bool cardVersion(const std::string& nfc_uid, uint64_t& out_version) const;
     DbResult getProductList(std::vector<ProductDTO>& out_products);
 };
 
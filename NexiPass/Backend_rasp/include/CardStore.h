@@ -0,0 +1,154 @@
+/* ==================== CardStore.h ==================== */
+
+#ifndef CARDSTORE_H
+#define CARDSTORE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+
+#include "Database.h"
+#include "Journal.h"
+
+/* ==================== Write Acknowledgement ==================== */
+
+enum class WriteAck {
+    Applied,     // Return once the in-memory state changed
+    Journaled,   // Return once the write is on local disk (Persisted without a journal)
+    Persisted    // Return once Postgres committed the write
+};
+
+struct CardStoreStatsDTO {
+    size_t cards = 0;
+    size_t pending = 0;          // Writes queued or in flight
+    uint64_t persisted = 0;
+    uint64_t conflicts = 0;      // Writes Postgres rejected after memory accepted them
+    uint64_t retries = 0;        // Writer passes retried after a connection error
+    uint64_t refreshes = 0;      // Cards re-read after a NOTIFY
+    uint64_t misses = 0;         // Lookups that had to read opencard
+
+    /* Offline journal */
+    bool journal = false;
+    uint64_t journal_backlog = 0;    // Journaled writes not yet in Postgres
+    uint64_t journal_fsyncs = 0;
+    uint64_t replay_skipped = 0;     // Records Postgres already had
+};
+
+/* ==================== CardStore Class ==================== */
+
+// Authoritative in-process copy of opencard keyed by card UID. Status,
+// phone and running total are answered from memory; activations,
+// consumptions and checkouts are applied here first and persisted by a
+// single writer thread in queue order, so writes to a card reach Postgres
+// in the order they were accepted. Card NOTIFYs (including the echo of our
+// own writes) queue a background re-read of that card.
+//
+// With a Journal every accepted write is appended to it before memory
+// changes, so an outage (or a restart during one) loses no sale: the
+// writer replays the journal in cursor-guarded batches once Postgres is
+// back, and records Postgres already committed are skipped.
+class CardStore {
+private:
+    struct PendingWrite {
+        enum class Kind { Activate, Consume, Checkout } kind;
+        string card_id;
+        int32_t phone = 0;
+        int32_t productId = 0;
+        int32_t employeeId = 0;
+        int32_t qty = 0;
+        double price = 0.0;
+        uint64_t seq = 0;
+        uint32_t attempts = 0;
+        bool cartNext = false;      // The next write belongs to the same cart
+        shared_ptr<promise<DbResult>> ack;
+    };
+
+    Database& db_;
+    Journal* journal_;
+
+    unordered_map<string, OpenCardDTO> cards_;
+    unordered_map<string, uint32_t> pendingByCard_;
+    unordered_map<string, uint64_t> stamps_;    // Change stamp per cached card
+    uint64_t changeSeq_ = 0;
+    mutable std::mutex mtx_;
+    condition_variable persistedCv_;
+
+    deque<PendingWrite> queue_;
+    set<string> refresh_;
+    bool refreshAll_ = false;
+    condition_variable queueCv_;
+
+    thread writer_;
+    atomic<bool> running_;
+    size_t batchLimit_ = 64;
+
+    uint64_t persisted_ = 0;
+    uint64_t conflicts_ = 0;
+    uint64_t retries_ = 0;
+    uint64_t refreshes_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t replaySkipped_ = 0;
+
+    static void applyToCard(OpenCardDTO& card, const PendingWrite& w);
+    void touch(const string& card_id);
+    static JournalRecordDTO toRecord(const PendingWrite& w);
+    static PendingWrite fromRecord(const JournalRecordDTO& rec);
+
+    DbResult findOrLoad(const string& card_id, unique_lock<mutex>& lock, OpenCardDTO*& out);
+    DbResult journalWrite(PendingWrite& w);
+    DbResult enqueue(PendingWrite w, WriteAck ack, unique_lock<mutex>& lock);
+    DbResult enqueueCart(vector<PendingWrite>& ws, WriteAck ack, unique_lock<mutex>& lock);
+    void replayBacklog();
+
+    void writerLoop();
+    size_t persistBatch(deque<PendingWrite>& batch);
+    size_t replayBatch(deque<PendingWrite>& batch);
+    void complete(PendingWrite& w, DbResult r);
+    bool refreshCards();
+    bool waitRetry(uint32_t failures);
+
+public:
+    explicit CardStore(Database& db, Journal* journal = nullptr);
+    ~CardStore();
+
+    CardStore(const CardStore&) = delete;
+    CardStore& operator=(const CardStore&) = delete;
+
+    // Replays what the journal still holds, loads every open card and
+    // starts the writer; also subscribes to the card channel, so call
+    // before Database::startListener()
+    bool start();
+    // Drains the write queue before returning
+    void stop();
+
+    DbResult lookup(const string& card_id, OpenCardDTO& out);
+    // Store-wide unique stamp of the card's last change, for response
+    // validators; false when the card is not in memory (never loads it)
+    bool version(const string& card_id, uint64_t& out) const;
+    DbResult activate(const string& card_id, int phone, WriteAck ack);
+    DbResult addConsumption(const string& card_id, int32_t productId, int32_t employeeId,
+                            int32_t qty, WriteAck ack);
+    // Every line is accepted or none is; the lines stay in one writer batch,
+    // so they reach Postgres in one transaction. total is the card's new total.
+    DbResult addCart(const string& card_id, int32_t employeeId, const vector<CartLineDTO>& lines,
+                     WriteAck ack, double& total);
+    DbResult checkout(const string& card_id, CheckoutDTO& out, WriteAck ack);
+
+    // Blocks until no write for this card is queued; false on timeout
+    bool waitPersisted(const string& card_id, chrono::milliseconds timeout);
+
+    void invalidate(const string& card_id);
+    void invalidateAll();
+
+    CardStoreStatsDTO stats() const;
+};
+
+#endif
@@ -5,8 +5,21 @@
 #include <vector>
 #include <cstdint>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <future>
+#include <functional>
+#include <optional>
+#include <string_view>
 #include <libpq-fe.h>
 
+#include "NotifyListener.h"
+#include "PgRowView.h"
+#include "QueryStats.h"
+
 using namespace std;
 
 /* ==================== DTOs ==================== */
@@ -34,6 +47,19 @@ struct ConsumptionLineDTO {
     string product_name;
 };
 
+struct ConsumptionItemDTO {
+    string card_id;
+    int32_t product_id = 0;
+    int32_t employee_id = 0;
+    int32_t qty = 0;
+};
+
+// One line of a cart; the card and employee are shared by the whole cart
+struct CartLineDTO {
+    int32_t product_id = 0;
+    int32_t qty = 0;
+};
+
 struct CardSummaryDTO {
     string card_id;
     int phone = 0;
@@ -42,6 +68,46 @@ struct CardSummaryDTO {
     vector<ConsumptionLineDTO> lines;
 };
 
+struct CatalogSnapshot;
+
+// One card_lines / card_lines_bare row, read in place
+struct CardLineRow : pgdecode::RowView {
+    using RowView::RowView;
+
+    uint64_t id_consumption() const noexcept { return static_cast<uint64_t>(integer(0)); }
+    int product_id() const noexcept { return static_cast<int>(integer(2)); }
+    int employee_id() const noexcept { return static_cast<int>(integer(3)); }
+    int qty() const noexcept { return static_cast<int>(integer(4)); }
+    double price_unit() const noexcept { return real(5); }
+    double line_total() const noexcept { return real(6); }
+    // Empty for card_lines_bare rows; see CardSummaryView::productName
+    string_view product_name() const noexcept { return columns() > 7 ? text(7) : string_view(); }
+};
+
+// CardSummaryDTO without the per-line copies: lines stay in the PGresult
+// and names in the catalogue snapshot, both kept alive by the view
+struct CardSummaryView {
+    string card_id;
+    int phone = 0;
+    char status = 'D';
+    double total_to_pay = 0.0;
+    pgdecode::ResultView<CardLineRow> lines;
+    shared_ptr<const CatalogSnapshot> catalog;
+    // Read from the replica, or with this card's writes still queued: the
+    // body may trail the in-memory card
+    bool maybe_stale = false;
+
+    string_view productName(const CardLineRow& line) const noexcept;
+};
+
+struct SalesBucketDTO {
+    int64_t bucket_start = 0;   // Epoch seconds
+    int product_id = 0;
+    int employee_id = 0;
+    uint64_t qty_total = 0;
+    double line_total = 0.0;
+};
+
 struct TotalsRowDTO {
     int product_id = 0;
     string product_name;
@@ -51,6 +117,79 @@ struct TotalsRowDTO {
     double line_total = 0.0;
 };
 
+struct CheckoutDTO {
+    string card_id;
+    int phone = 0;
+    double total_paid = 0.0;
+    uint64_t lines_closed = 0;
+    uint64_t qty_closed = 0;
+    vector<TotalsRowDTO> folded;   // What this checkout added to producttotals (ids only)
+};
+
+// One opencard row with the count and quantity of its open lines
+struct OpenCardDTO {
+    string card_id;
+    char status = 'D';
+    int phone = 0;
+    double total_to_pay = 0.0;
+    uint64_t lines = 0;
+    uint64_t qty = 0;
+};
+
+// One card write as recorded in the local journal; seq is unique per source
+struct JournalRecordDTO {
+    uint64_t seq = 0;
+    char kind = 'C';             // 'A' activate, 'C' consumption, 'K' checkout
+    string card_id;
+    int32_t phone = 0;
+    int32_t product_id = 0;
+    int32_t employee_id = 0;
+    int32_t qty = 0;
+    double price_unit = 0.0;     // Price charged when the sale was accepted
+};
+
+struct PoolStatsDTO {
+    size_t pool_size = 0;
+    size_t in_use = 0;
+    size_t peak_in_use = 0;
+    uint64_t leases = 0;
+    uint64_t lease_timeouts = 0;
+    uint64_t total_wait_us = 0;
+    uint64_t max_wait_us = 0;
+    double utilisation = 0.0;   // Fraction of pool time spent leased since connect()
+    int schema_version = 0;
+
+    /* Connection health (supervisor) */
+    size_t connections_up = 0;
+    uint64_t lease_unavailable = 0;   // Leases refused fast because every connection was down
+    uint64_t probe_failures = 0;
+    uint64_t reconnects = 0;
+    size_t async_up = 0;
+    size_t async_size = 0;
+    uint64_t async_reconnects = 0;
+
+    /* LISTEN/NOTIFY channel */
+    bool listener_running = false;
+    uint64_t notifications = 0;
+    uint64_t listener_reconnects = 0;
+
+    /* Product catalogue cache */
+    uint64_t catalog_version = 0;
+    uint64_t catalog_reloads = 0;
+
+    /* Product totals cache */
+    uint64_t totals_reloads = 0;
+    uint64_t totals_folds = 0;
+
+    /* Read replica */
+    bool replica_configured = false;
+    bool replica_usable = false;        // Reachable and within the staleness bound
+    int64_t replica_lag_ms = -1;
+    uint64_t replica_reads = 0;
+    uint64_t replica_fallbacks = 0;     // Eligible reads that went to the primary
+    uint64_t replica_reconnects = 0;
+};
+
 /* ==================== Result Enum ==================== */
 
 enum class DbResult {
@@ -65,15 +204,117 @@ enum class DbResult {
 
 /* ==================== Database Class ==================== */
 
+class AsyncExecutor;
+class ProductCatalog;
+class TotalsCache;
+class ReplicaPool;
+
 class Database {
 private:
     string connString_;
-    void* conn_;
     bool employeeViewMode_;
     mutable std::mutex modeMutex_;
+    atomic<bool> binaryResults_{false};
+
+    /* Connection Pool */
+    size_t poolSize_;
+    chrono::milliseconds leaseTimeout_;
+    vector<void*> pool_;
+    vector<size_t> freeSlots_;
+    vector<chrono::steady_clock::time_point> leasedAt_;
+    mutable std::mutex poolMtx_;
+    std::condition_variable poolCv_;
+
+    chrono::steady_clock::time_point poolSince_;
+    int schemaVersion_ = 0;
+    size_t peakInUse_ = 0;
+    uint64_t leases_ = 0;
+    uint64_t leaseTimeouts_ = 0;
+    uint64_t totalWaitUs_ = 0;
+    uint64_t maxWaitUs_ = 0;
+    uint64_t busyUs_ = 0;
+    uint64_t leaseUnavailable_ = 0;
+
+    /* Supervisor */
+    struct SlotHealth {
+        bool down = false;
+        uint32_t failures = 0;
+        chrono::steady_clock::time_point retryAt;
+    };
+    vector<SlotHealth> health_;
+    thread supervisor_;
+    atomic<bool> supervising_{false};
+    std::condition_variable superviseCv_;
+    chrono::milliseconds probeInterval_{5000};
+    chrono::hours housekeepingInterval_{6};
+    uint64_t probeFailures_ = 0;
+    uint64_t reconnects_ = 0;
+
+    void superviseLoop();
+    void superviseSlot(size_t slot, bool probeHealthy);
+    void housekeeping() noexcept;
+
+    // RAII handle on one pooled connection; every query path holds one
+    class Lease {
+    private:
+        Database& db_;
+        size_t slot_;
+        PGconn* pg_;
+
+    public:
+        explicit Lease(Database& db) noexcept;
+        ~Lease();
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        PGconn* get() const noexcept { return pg_; }
+        explicit operator bool() const noexcept;
+    };
+
+    /* Read Replica */
+    unique_ptr<ReplicaPool> replica_;
+
+    // Read-only statements: a replica connection when one is usable,
+    // otherwise an ordinary primary lease
+    class ReadLease {
+    private:
+        Database& db_;
+        PGconn* replica_;
+        optional<Lease> primary_;
+
+    public:
+        ReadLease(Database& db, bool replicaOk = true) noexcept;
+        ~ReadLease();
+
+        ReadLease(const ReadLease&) = delete;
+        ReadLease& operator=(const ReadLease&) = delete;
+
+        PGconn* get() const noexcept;
+        bool onReplica() const noexcept { return replica_ != nullptr; }
+        explicit operator bool() const noexcept;
+    };
+    bool replicaUsable() const noexcept;
+
+    /* Async Engine */
+    unique_ptr<AsyncExecutor> async_;
+
+    /* Product Catalogue Cache */
+    unique_ptr<ProductCatalog> catalog_;
+
+    /* Product Totals Cache */
+    unique_ptr<TotalsCache> totals_;
+    void foldCheckout(const CheckoutDTO& checkout);
+
+    /* Invalidation Channel */
+    unique_ptr<NotifyListener> listener_;
+    mutable std::mutex listenerMtx_;
+
+    bool acquireSlot(size_t& slot) noexcept;
+    void releaseSlot(size_t slot) noexcept;
 
 public:
-    explicit Database(string connString);
+    explicit Database(string connString, size_t poolSize = 4);
     ~Database();
 
     Database(const Database&) = delete;
@@ -90,15 +331,119 @@ public:
     DbResult authenticateUser(const string& username, const string& password, UserDTO& outUser) noexcept;
     DbResult activateCard(const string& card_id, int phone) noexcept;
     DbResult closeCard(const string& card_id) noexcept;
+    DbResult closeCard(const string& card_id, CheckoutDTO& out) noexcept;
     DbResult registerConsumption(const string& card_id, int32_t productId, int32_t employeeId, int32_t quantidade) noexcept;
+    DbResult registerConsumptions(const vector<ConsumptionItemDTO>& items, vector<DbResult>& results) noexcept;
+    // All lines in one statement, or none; newTotal is the card's total after it
+    DbResult registerCart(const string& card_id, int32_t employeeId, const vector<CartLineDTO>& lines,
+                          double& newTotal) noexcept;
+
+    /* Journal Replay */
+    // Applies records in one transaction together with the source's cursor
+    // row; records at or below the cursor are already in Postgres and are
+    // skipped as Ok. Returns TxError when the transaction rolled back.
+    DbResult applyJournal(const string& source, const vector<JournalRecordDTO>& records,
+                          vector<DbResult>& results, uint64_t& skipped) noexcept;
+    DbResult journalCursor(const string& source, uint64_t& lastSeq) noexcept;
+
+    /* Bulk Transfer (binary COPY) */
+    // Pulls card ids from next() until it returns false and streams them
+    // into a staging table; ids not yet in opencard are inserted inactive,
+    // existing cards are left alone. One transaction: all or nothing.
+    DbResult importCards(const function<bool(string&)>& next, uint64_t& inserted, uint64_t& skipped) noexcept;
+    // Rows reach the sink one at a time as COPY delivers them; returning
+    // false discards the rest. The lease is held until the stream ends.
+    DbResult exportConsumptions(const function<bool(const ConsumptionLineDTO&)>& sink) noexcept;
+    DbResult exportTotals(const function<bool(const TotalsRowDTO&)>& sink) noexcept;
+
+    /* Streaming Reports */
+    // Same rows as getTotals / getSalesHistory, handed to the sink as
+    // Postgres produces them (chunked rows with libpq >= 17, single-row
+    // mode before), so memory stays at one chunk whatever the result size.
+    // A sink returning false cancels the query.
+    DbResult streamTotals(const function<bool(const TotalsRowDTO&)>& sink) noexcept;
+    DbResult streamSalesHistory(int windowMinutes, int bucketMinutes,
+                                const function<bool(const SalesBucketDTO&)>& sink) noexcept;
     
     /* Queries */
-    DbResult getCardSummary(const string& card_id, CardSummaryDTO& out) noexcept;
+    // replicaOk=false keeps owner-mode reads on the primary, for callers
+    // that act on the card's status rather than display it
+    DbResult getCardSummary(const string& card_id, CardSummaryDTO& out, bool replicaOk = true) noexcept;
+    DbResult getCardSummary(const string& card_id, CardSummaryView& out) noexcept;
     DbResult getTotals(vector<TotalsRowDTO>& out) noexcept;
+    DbResult queryTotals(vector<TotalsRowDTO>& out) noexcept;      // Always hits Postgres
     DbResult listProducts(vector<ProductDTO>& out) noexcept;
+    DbResult queryProductList(vector<ProductDTO>& out) noexcept;   // Always hits Postgres
+    // Checked-out sales of the last windowMinutes, per (bucket, product,
+    // employee), from the per-minute rollup
+    DbResult getSalesHistory(int windowMinutes, int bucketMinutes, vector<SalesBucketDTO>& out) noexcept;
+    DbResult loadOpenCards(vector<OpenCardDTO>& out) noexcept;
+    DbResult loadOpenCards(const vector<string>& card_ids, vector<OpenCardDTO>& out) noexcept;
     
+    /* Supervision */
+    // Background probe of idle pooled connections; broken ones are reset
+    // with jittered exponential backoff and their statements re-prepared
+    void startSupervisor(chrono::milliseconds probeInterval = chrono::milliseconds(5000));
+    void stopSupervisor();
+
+    /* Product Catalogue Cache */
+    // Serves listProducts, consumption prices and summary product names
+    // from a versioned snapshot, refreshed on product NOTIFYs. Enable
+    // before startListener().
+    void enableCatalogCache();
+    shared_ptr<const CatalogSnapshot> catalogSnapshot();
+    void invalidateCatalog();
+
+    /* Product Totals Cache */
+    // Serves getTotals from memory: seeded here with one query, then every
+    // committed checkout folds its deltas in. Enable before startListener().
+    void enableTotalsCache();
+
+    /* Response Validators */
+    // Change whenever the cached content does, and cost no query: 0 when
+    // the cache is off, not loaded yet or stale (the next read reloads)
+    uint64_t catalogVersion() const noexcept;
+    uint64_t totalsVersion() const noexcept;
+
+    /* Invalidation Channel */
+    // Dedicated LISTEN connection; handlers run on the listener thread and
+    // receive a resync event after every (re)connect
+    void onNotify(const string& channel, NotifyHandler handler);
+    DbResult startListener() noexcept;
+    void stopListener() noexcept;
+
+    /* Async API */
+    // Futures complete on the event-loop thread; out-parameters must stay
+    // alive until then. Without startAsync() they run blocking and return
+    // a ready future.
+    DbResult startAsync(size_t connections) noexcept;
+    void stopAsync() noexcept;
+    bool asyncRunning() const noexcept;
+
+    future<DbResult> registerConsumptionAsync(const string& card_id, int32_t productId, int32_t employeeId, int32_t quantidade);
+    future<DbResult> closeCardAsync(const string& card_id, CheckoutDTO& out);
+    future<DbResult> getCardSummaryAsync(const string& card_id, CardSummaryDTO& out, bool replicaOk = true);
+    future<DbResult> getTotalsAsync(vector<TotalsRowDTO>& out);
+    future<DbResult> listProductsAsync(vector<ProductDTO>& out);
+
     /* Configuration */
     void setEmployeeViewMode(bool enabled) noexcept;
+    bool employeeViewMode() const noexcept;
+    void setLeaseTimeout(chrono::milliseconds timeout) noexcept;
+    void setBinaryResults(bool enabled) noexcept;
+    // Optional; call before connect(). Reports, exports and owner card
+    // summaries read from the replica while its replay lag is within
+    // maxLag, and from the primary otherwise.
+    void setReadReplica(string connString, size_t connections = 2,
+                        chrono::milliseconds maxLag = chrono::milliseconds(5000));
+
+    /* Diagnostics */
+    PoolStatsDTO poolStats() const noexcept;
+    // Latency, round trips, rows and errors per prepared statement and per
+    // batch (pipelines, COPY, transaction control); process-wide, only
+    // entries that ran at least once
+    vector<StatementStatsDTO> statementStats() const;
+    void resetStatementStats() noexcept;
 };
 
 #endif
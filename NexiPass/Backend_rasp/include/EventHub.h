@@ -0,0 +1,73 @@
+/* ==================== EventHub.h ==================== */
+
+#ifndef EVENTHUB_H
+#define EVENTHUB_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+#include "Database.h"
+
+enum class EventType : uint8_t {
+    Scan,
+    Activation,
+    Consumption,
+    Checkout
+};
+
+struct EventDTO {
+    uint64_t id = 0;                 // Monotonic, starts at 1
+    EventType type = EventType::Scan;
+    string card_id;
+    DbResult result = DbResult::Ok;  // Outcome of the operation (scans: lookup)
+    char status = '?';               // Scan: card status, when found
+    int32_t product_id = 0;          // Consumption
+    int32_t employee_id = 0;
+    int32_t quantity = 0;
+    double amount = 0.0;             // Scan: total to pay; checkout: total paid
+};
+
+/* ==================== EventHub Class ==================== */
+
+// Recent scans and card operation outcomes, numbered in publish order and
+// kept in a fixed ring so a subscriber that reconnects can resume from the
+// last id it saw. Publishing never blocks on subscribers: a reader that
+// falls more than a ring behind is told it missed events.
+class EventHub {
+private:
+    mutable std::mutex mtx_;
+    mutable condition_variable cv_;
+    vector<EventDTO> ring_;
+    uint64_t lastId_ = 0;
+    bool closed_ = false;
+
+public:
+    explicit EventHub(size_t capacity = 1024);
+
+    EventHub(const EventHub&) = delete;
+    EventHub& operator=(const EventHub&) = delete;
+
+    // Assigns ev.id, stores a copy and wakes every waiting reader
+    uint64_t publish(EventDTO ev);
+
+    // Appends up to max events with id > cursor to out and advances cursor
+    // past them. Returns false when some were already overwritten (out then
+    // starts at the oldest event still held). A cursor ahead of the hub,
+    // from before a restart, starts over from the beginning.
+    bool since(uint64_t& cursor, vector<EventDTO>& out, size_t max) const;
+
+    // Blocks until an event with id > cursor exists; false on timeout or close
+    bool waitAfter(uint64_t cursor, std::chrono::milliseconds timeout) const;
+
+    uint64_t lastId() const;
+
+    // Wakes every waiter for good; publishing still works
+    void close();
+    bool closed() const;
+};
+
+#endif
@@ -0,0 +1,94 @@
+/* ==================== Journal.h ==================== */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "Database.h"
+
+struct JournalStatsDTO {
+    uint64_t last_seq = 0;
+    uint64_t applied_seq = 0;
+    uint64_t appended = 0;
+    uint64_t fsyncs = 0;
+    uint64_t compactions = 0;
+    uint64_t bytes = 0;          // Current file size
+};
+
+/* ==================== Journal Class ==================== */
+
+// Local append-only log of card writes, one checksummed text line per
+// record. Appends only write(); durability is group-committed: the first
+// waiter runs fdatasync for everything written so far while later waiters
+// block on it, so a burst of sales shares one flush. Once every record is
+// known to be in Postgres the file is rewritten down to its header, which
+// keeps the applied sequence so numbering never restarts. The header also
+// carries an epoch drawn when the file is created: numbering does restart
+// with a new file, so its records are tracked under their own cursor.
+class Journal {
+private:
+    string path_;
+    string source_;
+    string epoch_;                // Empty for files from before epochs
+    string key_;                  // source_, plus @epoch_ when there is one
+    int fd_ = -1;
+
+    mutable std::mutex mtx_;
+    condition_variable syncCv_;
+    bool syncing_ = false;
+
+    uint64_t lastSeq_ = 0;
+    uint64_t writtenSeq_ = 0;     // Highest seq handed to write()
+    uint64_t durableSeq_ = 0;     // Highest seq covered by an fdatasync
+    uint64_t appliedSeq_ = 0;     // Highest seq known to be in Postgres
+    uint64_t bytes_ = 0;
+    size_t compactBytes_ = 1 << 20;
+
+    uint64_t appended_ = 0;
+    uint64_t fsyncs_ = 0;
+    uint64_t compactions_ = 0;
+
+    vector<JournalRecordDTO> recovered_;
+
+    bool recover();
+    bool rewrite(uint64_t appliedSeq);
+
+public:
+    // source identifies this terminal; with the file's epoch it keys the
+    // journalcursor row
+    Journal(string path, string source);
+    ~Journal();
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // Reads the file back (dropping a torn last line) or creates it
+    bool open();
+    void close();
+
+    // The journalcursor key; valid once open() succeeded
+    const string& source() const { return key_; }
+
+    // Records after the header checkpoint, as found by open()
+    vector<JournalRecordDTO> unapplied() const;
+    // Never hand out a seq at or below one Postgres has already seen
+    void reserveThrough(uint64_t seq);
+
+    // Assigns rec.seq and writes the line; false on I/O error
+    bool append(JournalRecordDTO& rec);
+    // Same for several records in one write(): all are appended or none
+    bool append(vector<JournalRecordDTO>& recs);
+    // Blocks until seq is on disk; false on I/O error
+    bool waitDurable(uint64_t seq);
+    // Records up to seq reached Postgres (or were rejected by it)
+    void markApplied(uint64_t seq);
+
+    JournalStatsDTO stats() const;
+};
+
+#endif
@@ -0,0 +1,77 @@
+/* ==================== NotifyListener.h ==================== */
+
+#ifndef NOTIFYLISTENER_H
+#define NOTIFYLISTENER_H
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <string>
+#include <functional>
+#include <libpq-fe.h>
+
+/* ==================== Channels ==================== */
+
+// Raised by row triggers on product, opencard and users; the payload is
+// the row key (product_id, card_id or user_id)
+#define NOTIFY_CHANNEL_PRODUCT   "nexipass_product"
+#define NOTIFY_CHANNEL_CARD      "nexipass_card"
+#define NOTIFY_CHANNEL_USER      "nexipass_user"
+// Raised once per statement writing producttotals; the payload is the
+// writer's nexipass.writer setting (empty for sessions that set none)
+#define NOTIFY_CHANNEL_TOTALS    "nexipass_totals"
+
+struct DbNotification {
+    std::string channel;
+    std::string payload;
+    // Set after every (re)connect: notifications may have been missed, so
+    // the receiver must drop everything it caches for this channel
+    bool resync = false;
+};
+
+using NotifyHandler = std::function<void(const DbNotification&)>;
+
+// Holds one dedicated connection that LISTENs on the invalidation channels
+// and dispatches every NOTIFY to the handlers registered for its channel.
+// Handlers run on the listener thread and must not block.
+class NotifyListener {
+private:
+    std::string connString_;
+    PGconn* pg_{nullptr};
+
+    std::map<std::string, std::vector<NotifyHandler>> handlers_;
+    std::mutex handlersMtx_;
+
+    std::thread thread_;
+    std::atomic<bool> running_;
+    std::atomic<uint64_t> received_;
+    std::atomic<uint64_t> reconnects_;
+    int stopFd_{-1};
+
+    void listenLoop();
+    bool openConnection();
+    void installTriggers();
+    void dispatch(const DbNotification& n);
+    void dispatchResync();
+    bool waitStopMs(int ms);
+
+public:
+    explicit NotifyListener(std::string connString);
+    ~NotifyListener();
+
+    NotifyListener(const NotifyListener&) = delete;
+    NotifyListener& operator=(const NotifyListener&) = delete;
+
+    void subscribe(const std::string& channel, NotifyHandler handler);
+
+    bool start();
+    void stop();
+    bool isRunning() const { return running_; }
+
+    uint64_t received() const { return received_; }
+    uint64_t reconnects() const { return reconnects_; }
+};
+
+#endif
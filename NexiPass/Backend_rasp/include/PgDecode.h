@@ -0,0 +1,124 @@
+#ifndef PGDECODE_H
+#define PGDECODE_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <libpq-fe.h>
+
+/* ==================== Type OIDs (pg_type.dat) ==================== */
+
+#define PG_OID_CHAR       18
+#define PG_OID_INT8       20
+#define PG_OID_INT2       21
+#define PG_OID_INT4       23
+#define PG_OID_TEXT       25
+#define PG_OID_FLOAT4     700
+#define PG_OID_FLOAT8     701
+#define PG_OID_BPCHAR     1042
+#define PG_OID_VARCHAR    1043
+#define PG_OID_NUMERIC    1700
+
+/* ==================== Typed Column Decoders ==================== */
+
+// Each decoder reads one cell straight out of the PGresult buffer. Binary
+// cells (resultFormat = 1) are decoded by column type; text cells fall back
+// to strtoll/strtod, so callers work the same with either result format.
+
+namespace pgdecode {
+
+inline uint16_t be16(const char* p) {
+    const auto* u = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<uint16_t>((u[0] << 8) | u[1]);
+}
+
+inline uint32_t be32(const char* p) {
+    const auto* u = reinterpret_cast<const unsigned char*>(p);
+    return (uint32_t(u[0]) << 24) | (uint32_t(u[1]) << 16) | (uint32_t(u[2]) << 8) | uint32_t(u[3]);
+}
+
+inline uint64_t be64(const char* p) {
+    return (uint64_t(be32(p)) << 32) | be32(p + 4);
+}
+
+// Binary numeric: ndigits, weight, sign, dscale, then base-10000 digits
+inline double numericToDouble(const char* p, int len) {
+    if (len < 8) return 0.0;
+    int ndigits = static_cast<int16_t>(be16(p));
+    int weight = static_cast<int16_t>(be16(p + 2));
+    uint16_t sign = be16(p + 4);
+
+    if (sign == 0xC000) return NAN;
+    if (len < 8 + 2 * ndigits) return 0.0;
+
+    double v = 0.0;
+    for (int i = 0; i < ndigits; ++i) {
+        v = v * 10000.0 + be16(p + 8 + 2 * i);
+    }
+    v *= std::pow(10000.0, weight - ndigits + 1);
+    return (sign == 0x4000) ? -v : v;
+}
+
+inline int64_t asInt(const PGresult* res, int row, int col, int64_t fallback = 0) {
+    if (PQgetisnull(res, row, col)) return fallback;
+    const char* p = PQgetvalue(res, row, col);
+
+    if (PQfformat(res, col) == 0) return std::strtoll(p, nullptr, 10);
+
+    switch (PQftype(res, col)) {
+        case PG_OID_INT2: return static_cast<int16_t>(be16(p));
+        case PG_OID_INT4: return static_cast<int32_t>(be32(p));
+        case PG_OID_INT8: return static_cast<int64_t>(be64(p));
+        case PG_OID_NUMERIC: return static_cast<int64_t>(numericToDouble(p, PQgetlength(res, row, col)));
+        default: return fallback;
+    }
+}
+
+inline double asDouble(const PGresult* res, int row, int col, double fallback = 0.0) {
+    if (PQgetisnull(res, row, col)) return fallback;
+    const char* p = PQgetvalue(res, row, col);
+
+    if (PQfformat(res, col) == 0) return std::strtod(p, nullptr);
+
+    switch (PQftype(res, col)) {
+        case PG_OID_NUMERIC: return numericToDouble(p, PQgetlength(res, row, col));
+        case PG_OID_FLOAT8: {
+            uint64_t bits = be64(p);
+            double d;
+            static_assert(sizeof(d) == sizeof(bits), "float8 must be 64-bit");
+            std::memcpy(&d, &bits, sizeof(d));
+            return d;
+        }
+        case PG_OID_FLOAT4: {
+            uint32_t bits = be32(p);
+            float f;
+            std::memcpy(&f, &bits, sizeof(f));
+            return f;
+        }
+        case PG_OID_INT2:
+        case PG_OID_INT4:
+        case PG_OID_INT8:
+            return static_cast<double>(asInt(res, row, col));
+        default: return fallback;
+    }
+}
+
+// char, bpchar, text and varchar share the same wire bytes in both formats
+inline char asChar(const PGresult* res, int row, int col, char fallback = '?') {
+    if (PQgetisnull(res, row, col) || PQgetlength(res, row, col) == 0) return fallback;
+    return PQgetvalue(res, row, col)[0];
+}
+
+inline void assignText(std::string& out, const PGresult* res, int row, int col) {
+    if (PQgetisnull(res, row, col)) {
+        out.clear();
+        return;
+    }
+    out.assign(PQgetvalue(res, row, col), static_cast<size_t>(PQgetlength(res, row, col)));
+}
+
+} // namespace pgdecode
+
+#endif
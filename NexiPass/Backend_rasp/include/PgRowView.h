@@ -0,0 +1,91 @@
+#ifndef PGROWVIEW_H
+#define PGROWVIEW_H
+
+#include <memory>
+#include <iterator>
+#include <string_view>
+#include <libpq-fe.h>
+
+#include "PgDecode.h"
+
+/* ==================== Result Row Views ==================== */
+
+// Typed, non-owning access to the rows of a PGresult. A ResultView shares
+// ownership of the result, so rows and the string_views they hand out stay
+// valid for as long as any copy of the view lives; nothing is copied out
+// of the libpq buffer until the caller asks for a value.
+
+namespace pgdecode {
+
+using ResultPtr = std::shared_ptr<PGresult>;
+
+inline ResultPtr adopt(PGresult* res) {
+    return ResultPtr(res, PQclear);
+}
+
+// Base of the per-query row types, which add named accessors on top
+class RowView {
+protected:
+    const PGresult* res_;
+    int row_;
+
+public:
+    RowView(const PGresult* res, int row) noexcept : res_(res), row_(row) {}
+
+    int columns() const noexcept { return PQnfields(res_); }
+    bool isNull(int col) const noexcept { return PQgetisnull(res_, row_, col) != 0; }
+
+    int64_t integer(int col, int64_t fallback = 0) const noexcept { return asInt(res_, row_, col, fallback); }
+    double real(int col, double fallback = 0.0) const noexcept { return asDouble(res_, row_, col, fallback); }
+    char character(int col, char fallback = '?') const noexcept { return asChar(res_, row_, col, fallback); }
+
+    // Points into the result; text bytes are the same in both formats
+    std::string_view text(int col) const noexcept {
+        if (PQgetisnull(res_, row_, col)) return {};
+        return std::string_view(PQgetvalue(res_, row_, col), static_cast<size_t>(PQgetlength(res_, row_, col)));
+    }
+};
+
+template <class Row>
+class ResultView {
+private:
+    ResultPtr res_;
+
+public:
+    class iterator {
+    private:
+        const PGresult* res_;
+        int row_;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Row;
+        using difference_type = int;
+        using pointer = void;
+        using reference = Row;
+
+        iterator(const PGresult* res, int row) noexcept : res_(res), row_(row) {}
+
+        Row operator*() const noexcept { return Row(res_, row_); }
+        iterator& operator++() noexcept { ++row_; return *this; }
+        bool operator==(const iterator& o) const noexcept { return row_ == o.row_; }
+        bool operator!=(const iterator& o) const noexcept { return row_ != o.row_; }
+    };
+
+    ResultView() = default;
+    explicit ResultView(ResultPtr res) noexcept : res_(std::move(res)) {}
+
+    bool ok() const noexcept { return res_ && PQresultStatus(res_.get()) == PGRES_TUPLES_OK; }
+    int size() const noexcept { return ok() ? PQntuples(res_.get()) : 0; }
+    bool empty() const noexcept { return size() == 0; }
+
+    Row operator[](int row) const noexcept { return Row(res_.get(), row); }
+    iterator begin() const noexcept { return iterator(res_.get(), 0); }
+    iterator end() const noexcept { return iterator(res_.get(), size()); }
+
+    void reset() noexcept { res_.reset(); }
+};
+
+} // namespace pgdecode
+
+#endif
@@ -0,0 +1,62 @@
+/* ==================== ProductCatalog.h ==================== */
+
+#ifndef PRODUCTCATALOG_H
+#define PRODUCTCATALOG_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#include "Database.h"
+
+/* ==================== Catalogue Snapshot ==================== */
+
+// Immutable once published; readers keep whichever snapshot they loaded
+struct CatalogSnapshot {
+    uint64_t version = 0;
+    vector<ProductDTO> products;    // Ordered by name, as /products serves it
+    vector<int32_t> slotById;       // product_id -> index into products, -1 if absent
+
+    const ProductDTO* find(int32_t productId) const {
+        if (productId < 0 || static_cast<size_t>(productId) >= slotById.size()) return nullptr;
+        int32_t slot = slotById[productId];
+        return slot < 0 ? nullptr : &products[slot];
+    }
+};
+
+/* ==================== ProductCatalog Class ==================== */
+
+// Versioned in-memory copy of the product table. A NOTIFY on the product
+// channel only bumps the invalidation generation; the next reader reloads
+// and swaps in a new snapshot while the others keep reading the old one.
+class ProductCatalog {
+private:
+    shared_ptr<const CatalogSnapshot> current_;
+    atomic<uint64_t> invalidations_;
+    atomic<uint64_t> loadedGeneration_;
+    atomic<uint64_t> reloads_;
+    std::mutex reloadMtx_;
+
+public:
+    ProductCatalog();
+
+    ProductCatalog(const ProductCatalog&) = delete;
+    ProductCatalog& operator=(const ProductCatalog&) = delete;
+
+    // Returns the current snapshot, reloading through db first if it is
+    // stale (or missing). Null only if nothing could ever be loaded.
+    shared_ptr<const CatalogSnapshot> get(Database& db);
+    shared_ptr<const CatalogSnapshot> peek() const;
+
+    void invalidate();
+    bool isStale() const;
+    uint64_t version() const;
+    uint64_t reloads() const { return reloads_; }
+
+private:
+    bool reload(Database& db);
+};
+
+#endif
@@ -0,0 +1,67 @@
+/* ==================== QueryStats.h ==================== */
+
+#ifndef QUERYSTATS_H
+#define QUERYSTATS_H
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <libpq-fe.h>
+
+// Why a statement failed, by SQLSTATE class
+enum class QueryError : uint8_t {
+    None = 0,
+    Connection,     // No reply, or class 08
+    Constraint,     // Class 23: unique, foreign key, check
+    Conflict,       // Class 40 and 55P03: serialization, deadlock, lock timeout
+    Other,
+    Count
+};
+
+struct StatementStatsDTO {
+    std::string name;
+    uint64_t calls = 0;
+    uint64_t round_trips = 0;
+    uint64_t rows = 0;
+    uint64_t errors_connection = 0;
+    uint64_t errors_constraint = 0;
+    uint64_t errors_conflict = 0;
+    uint64_t errors_other = 0;
+    uint64_t mean_us = 0;
+    uint64_t p50_us = 0;        // Percentiles are interpolated within
+    uint64_t p90_us = 0;        // power-of-two buckets
+    uint64_t p99_us = 0;
+    uint64_t max_us = 0;
+};
+
+/* ==================== StatementStats Class ==================== */
+
+// Counters and latency histogram for one statement (or one batch of them).
+// Every field is a relaxed atomic so the hot path never takes a lock; a
+// snapshot taken under load may be off by the calls still in flight.
+class StatementStats {
+public:
+    // Bucket b holds latencies in [2^(b-1), 2^b) microseconds; the last
+    // one (from ~67 s) is open-ended
+    static constexpr size_t kBuckets = 28;
+
+private:
+    std::atomic<uint64_t> roundTrips_{0};
+    std::atomic<uint64_t> rows_{0};
+    std::atomic<uint64_t> sumUs_{0};
+    std::atomic<uint64_t> maxUs_{0};
+    std::atomic<uint64_t> errors_[static_cast<size_t>(QueryError::Count)] = {};
+    std::atomic<uint64_t> buckets_[kBuckets] = {};
+
+public:
+    void record(uint64_t us, uint32_t roundTrips, uint64_t rows, QueryError error) noexcept;
+    StatementStatsDTO snapshot(const char* name) const;
+    void reset() noexcept;
+};
+
+// Error class of a finished result; pg may be null (async completions)
+QueryError classifyResult(const PGconn* pg, const PGresult* res) noexcept;
+// Rows returned, or rows affected for INSERT/UPDATE/DELETE without RETURNING
+uint64_t resultRows(const PGresult* res) noexcept;
+
+#endif
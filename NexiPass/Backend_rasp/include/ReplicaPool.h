@@ -0,0 +1,73 @@
+/* ==================== ReplicaPool.h ==================== */
+
+#ifndef REPLICAPOOL_H
+#define REPLICAPOOL_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <libpq-fe.h>
+
+// Small blocking pool on a read replica. It is only handed out while the
+// replica is reachable and its replay lag is within the staleness bound;
+// otherwise acquire() fails at once and the caller reads from the primary.
+// Health and lag are refreshed by Database's supervisor through probe().
+class ReplicaPool {
+private:
+    std::string connString_;
+    size_t nConns_;
+    std::function<bool(PGconn*)> init_;
+    std::chrono::milliseconds maxLag_;
+
+    std::vector<PGconn*> conns_;
+    std::vector<size_t> free_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+
+    // Whole-replica state: one lag figure and one backoff for all slots
+    bool down_ = true;
+    uint32_t failures_ = 0;
+    std::chrono::steady_clock::time_point retryAt_;
+
+    std::atomic<bool> usable_;
+    std::atomic<int64_t> lagMs_;
+    std::atomic<uint64_t> reads_;
+    std::atomic<uint64_t> fallbacks_;
+    std::atomic<uint64_t> reconnects_;
+
+    bool open(PGconn*& pg);
+    bool measureLag(PGconn* pg, int64_t& lagMs);
+
+public:
+    ReplicaPool(std::string connString, size_t connections, std::chrono::milliseconds maxLag,
+                std::function<bool(PGconn*)> init);
+    ~ReplicaPool();
+
+    ReplicaPool(const ReplicaPool&) = delete;
+    ReplicaPool& operator=(const ReplicaPool&) = delete;
+
+    // Opens every connection; a replica that is down now is retried by probe()
+    bool connect();
+    void close();
+
+    // Waits up to timeout for an idle replica connection; nullptr means
+    // "use the primary" (replica down, too far behind, or saturated)
+    PGconn* acquire(std::chrono::milliseconds timeout);
+    void release(PGconn* pg);
+
+    // Measures lag on an idle connection and resets broken ones with
+    // backoff. Called from the supervisor thread.
+    void probe();
+
+    bool usable() const { return usable_; }
+    int64_t lagMs() const { return lagMs_; }
+    uint64_t reads() const { return reads_; }
+    uint64_t fallbacks() const { return fallbacks_; }
+    uint64_t reconnects() const { return reconnects_; }
+};
+
+#endif
@@ -0,0 +1,27 @@
+/* ==================== Schema.h ==================== */
+
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <libpq-fe.h>
+
+struct SchemaStatusDTO {
+    int found = 0;          // Version recorded before this run
+    int version = 0;        // Version after this run
+    int applied = 0;        // Migrations applied by this run
+};
+
+/* ==================== Schema Migrations ==================== */
+
+// Highest version this binary knows how to build
+int schemaLatestVersion() noexcept;
+
+// Brings the database up to schemaLatestVersion(): pending migrations run
+// in order inside one transaction and are recorded in schemaversion, so a
+// failure leaves the previous layout intact. Terminals starting together
+// are serialised by an advisory lock; the loser finds nothing to do.
+// A database already at (or past) the latest version costs one query and
+// needs no DDL rights.
+bool migrateSchema(PGconn* pg, SchemaStatusDTO& out) noexcept;
+
+#endif
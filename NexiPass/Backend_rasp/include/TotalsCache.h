@@ -0,0 +1,70 @@
+/* ==================== TotalsCache.h ==================== */
+
+#ifndef TOTALSCACHE_H
+#define TOTALSCACHE_H
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <cstdint>
+
+#include "Database.h"
+
+/* ==================== TotalsCache Class ==================== */
+
+// In-memory copy of producttotals keyed by (product, employee), seeded by
+// one totals_report query and then kept current by folding in the deltas
+// every committed checkout returns. Readers copy the map in key order, so
+// /product_totals costs no database work. Product and user NOTIFYs (names
+// may have changed), producttotals writes by any other session (another
+// terminal's checkout), listener resyncs and a delta for a pair whose names
+// are unknown mark it stale; the next reader reseeds it.
+class TotalsCache {
+private:
+    map<pair<int, int>, TotalsRowDTO> rows_;
+    mutable std::mutex mtx_;
+    bool loaded_ = false;
+    // Checkouts between send and fold; a seed that overlaps one may count it
+    // and then see it folded in too, so it is not installed
+    uint32_t checkoutsInFlight_ = 0;
+    uint64_t checkoutsBegun_ = 0;
+
+    atomic<uint64_t> invalidations_;
+    atomic<uint64_t> loadedGeneration_;
+    atomic<uint64_t> reloads_;
+    atomic<uint64_t> folds_;
+    atomic<uint64_t> version_;      // Bumped whenever rows_ changes
+    std::mutex reloadMtx_;
+
+    void copyTo(vector<TotalsRowDTO>& out) const;
+    DbResult reload(Database& db, vector<TotalsRowDTO>& out);
+
+public:
+    TotalsCache();
+
+    TotalsCache(const TotalsCache&) = delete;
+    TotalsCache& operator=(const TotalsCache&) = delete;
+
+    // Serves the current totals, reseeding first when stale (or never loaded)
+    DbResult get(Database& db, vector<TotalsRowDTO>& out);
+
+    // Bracket every checkout (or batch holding one) from before it is sent
+    // until after its fold, whether it committed or not
+    void beginCheckout();
+    void endCheckout();
+
+    // Adds a checkout's per-(product, employee) deltas; product names come
+    // from the catalogue snapshot when there is one
+    void fold(const vector<TotalsRowDTO>& deltas, const CatalogSnapshot* cat);
+
+    void invalidate();
+    bool isStale() const;
+    // Identifies the served rows while the cache is fresh
+    uint64_t version() const { return version_.load(memory_order_acquire); }
+    uint64_t reloads() const { return reloads_; }
+    uint64_t folds() const { return folds_; }
+};
+
+#endif
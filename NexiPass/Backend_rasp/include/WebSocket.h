@@ -0,0 +1,50 @@
+/* ==================== WebSocket.h ==================== */
+
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <string>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+// Minimal RFC 6455 server side over a blocking socket: the upgrade
+// handshake, message reads (reassembling fragments, answering pings) and
+// unfragmented frame writes. No extensions, no subprotocols.
+
+namespace ws {
+
+enum class Opcode : uint8_t {
+    Continuation = 0x0,
+    Text = 0x1,
+    Binary = 0x2,
+    Close = 0x8,
+    Ping = 0x9,
+    Pong = 0xA
+};
+
+// Largest message accepted from a client; bigger ones close the socket
+static const size_t kMaxMessage = 64 * 1024;
+
+// Reads the HTTP upgrade request and answers 101. On anything that is not
+// a WebSocket upgrade it answers 400 and returns false. path receives the
+// request target without its query string. The whole request must arrive
+// within timeout (enforced with SO_RCVTIMEO, cleared again on success), so
+// a peer that connects and sends nothing cannot hold the socket.
+bool acceptHandshake(int fd, std::string& path, std::chrono::milliseconds timeout);
+
+// Reads one whole Text or Binary message into out. Pings are answered and
+// pongs skipped along the way; control replies go through write so the
+// caller can serialise them with its other writers. Returns false on close,
+// protocol error or socket error.
+using FrameWriter = std::function<bool(Opcode, const char*, size_t)>;
+bool readMessage(int fd, std::string& out, Opcode& op, const FrameWriter& write);
+
+// Sends one final, unmasked frame. Not thread-safe: callers writing from
+// several threads hold their own lock.
+bool writeFrame(int fd, Opcode op, const char* data, size_t len);
+
+} // namespace ws
+
+#endif
@@ -2,23 +2,245 @@
 
 #include "ApiController.h"
 #include "SimpleRFID.h"
+#include "WebSocket.h"
 #include <nlohmann/json.hpp>
 #include <iostream>
+#include <cmath>
+#include <cstdio>
 #include <sched.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
 
 using json = nlohmann::json;
 using namespace std;
 
+// Long-polls park an HTTP worker each, so the pool is sized for every
+// tablet waiting at once with room left for ordinary requests
+static const size_t kHttpThreads = 32;
+// Upper bound on how long one /wait_card may block
+static const long kMaxWaitCardMs = 30000;
+// Event streams and parked long-polls each hold a worker; together they
+// may take at most half the pool so sales and checkouts are never starved
+static const size_t kMaxEventStreams = 8;
+static const size_t kMaxParkedPolls = 8;
+// POS tablets hold one WebSocket each at ws://<host>:5001/pos
+static const int kPosSocketPort = 5001;
+static const size_t kMaxPosSessions = 16;
+// A connection that has not sent its upgrade request by then is dropped
+static const chrono::milliseconds kPosHandshakeTimeout(5000);
+// Largest order /add_consumptions accepts in one request
+static const size_t kMaxCartLines = 100;
+
+/* ==================== Streaming Response Helpers ==================== */
+
+static void csvField(string& out, const string& v) {
+    if (v.find_first_of(",\"\r\n") == string::npos) {
+        out += v;
+        return;
+    }
+    out += '"';
+    for (char c : v) {
+        if (c == '"') out += '"';
+        out += c;
+    }
+    out += '"';
+}
+
+// Streams rows as one chunked response: rows are batched into ~16 KB
+// writes and nothing larger than one batch is ever held in memory, so the
+// first bytes leave as soon as Postgres produces the first rows. A client
+// that goes away stops the sink, and the rest of the query is discarded.
+template <typename Row, typename Run, typename Format>
+static void streamRows(httplib::Response& res, const char* contentType, const char* open,
+                       const char* separator, const char* close, Run run, Format format) {
+    res.set_chunked_content_provider(contentType,
+        [open, separator, close, run, format](size_t, httplib::DataSink& sink) {
+        string buf = open;
+        bool first = true;
+        bool alive = true;
+
+        DbResult r = run([&](const Row& row) {
+            if (!first) buf += separator;
+            first = false;
+            format(buf, row);
+            if (buf.size() >= 16 * 1024) {
+                alive = sink.write(buf.data(), buf.size());
+                buf.clear();
+            }
+            return alive;
+        });
+
+        // A failed stream ends the response without its terminating chunk,
+        // so the client cannot mistake a truncated body for a whole one
+        if (r != DbResult::Ok) return false;
+        buf += close;
+        if (alive) alive = sink.write(buf.data(), buf.size());
+        if (alive) sink.done();
+        return alive;
+    });
+}
+
+template <typename Row, typename Run, typename Format>
+static void streamCsv(httplib::Response& res, const char* header, Run run, Format format) {
+    streamRows<Row>(res, "text/csv", header, "", "", run, format);
+}
+
+template <typename Row, typename Run, typename Format>
+static void streamJsonArray(httplib::Response& res, Run run, Format format) {
+    streamRows<Row>(res, "application/json", "[", ",", "]", run, format);
+}
+
+/* ==================== Conditional GET ==================== */
+
+// Validators come from in-process change counters, so a client that
+// already has the current version gets a bare 304 before any read or
+// serialisation. Strong tags; a W/ prefix from the client is ignored.
+
+// The counters restart with the process; the start time keeps a tag from
+// a previous run from matching a new one
+static string etagOf(const string& body) {
+    static const string epoch = to_string(
+        chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count());
+    return '"' + epoch + '-' + body + '"';
+}
+
+static bool notModified(const httplib::Request& req, httplib::Response& res, const string& etag) {
+    if (etag.empty()) return false;
+
+    const string header = req.get_header_value("If-None-Match");
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t end = header.find(',', pos);
+        if (end == string::npos) end = header.size();
+        string tag = header.substr(pos, end - pos);
+        pos = end + 1;
+
+        size_t b = tag.find_first_not_of(" \t");
+        size_t e = tag.find_last_not_of(" \t");
+        if (b == string::npos) continue;
+        tag = tag.substr(b, e - b + 1);
+        if (tag.compare(0, 2, "W/") == 0) tag.erase(0, 2);
+
+        if (tag == etag || tag == "*") {
+            res.status = 304;
+            res.set_header("ETag", etag);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* ==================== Direct JSON Writers ==================== */
+
+// Hot responses built straight from result views append to one reserved
+// buffer instead of assembling a json tree per row
+static void jsonString(string& out, string_view v) {
+    out += '"';
+    for (char c : v) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char esc[8];
+                    snprintf(esc, sizeof(esc), "\\u%04x", static_cast<unsigned>(c));
+                    out += esc;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+static void jsonNumber(string& out, double v) {
+    if (!std::isfinite(v)) {
+        out += "null";
+        return;
+    }
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%.15g", v);
+    out.append(buf, static_cast<size_t>(n));
+}
+
+/* ==================== Server-Sent Events ==================== */
+
+static const char* resultName(DbResult r) {
+    switch (r) {
+        case DbResult::Ok:               return "ok";
+        case DbResult::NotFound:         return "not_found";
+        case DbResult::InvalidState:     return "invalid_state";
+        case DbResult::ConstraintFailed: return "constraint_failed";
+        case DbResult::ConnectionError:  return "connection_error";
+        case DbResult::TxError:          return "tx_error";
+        default:                         return "unknown_error";
+    }
+}
+
+static const char* eventName(EventType t) {
+    switch (t) {
+        case EventType::Scan:        return "scan";
+        case EventType::Activation:  return "activation";
+        case EventType::Consumption: return "consumption";
+        default:                     return "checkout";
+    }
+}
+
+// The members of an event's JSON object, shared by /events and /pos
+static void eventFields(string& out, const EventDTO& ev) {
+    out += "\"card_id\":";
+    jsonString(out, ev.card_id);
+
+    if (ev.type == EventType::Scan) {
+        out += ",\"valid\":";
+        out += ev.result == DbResult::Ok ? "true" : "false";
+        out += ",\"status\":";
+        jsonString(out, string_view(&ev.status, 1));
+        out += ",\"total\":";
+        jsonNumber(out, ev.amount);
+    } else {
+        out += ",\"ok\":";
+        out += ev.result == DbResult::Ok ? "true" : "false";
+        out += ",\"result\":\"";
+        out += resultName(ev.result);
+        out += '"';
+        if (ev.type == EventType::Consumption) {
+            out += ",\"product_id\":" + to_string(ev.product_id) +
+                   ",\"employee_id\":" + to_string(ev.employee_id) +
+                   ",\"quantity\":" + to_string(ev.quantity);
+        } else if (ev.type == EventType::Checkout) {
+            out += ",\"total_paid\":";
+            jsonNumber(out, ev.amount);
+        }
+    }
+}
+
+// One SSE frame; the data line is a single-line JSON object
+static void sseEvent(string& out, const EventDTO& ev) {
+    out += "id: " + to_string(ev.id) + "\nevent: " + eventName(ev.type) + "\ndata: {";
+    eventFields(out, ev);
+    out += "}\n\n";
+}
+
 /* ==================== Lifecycle ==================== */
 
 ApiController::ApiController(Database* db, CardService* cs, FeedbackController* fb)
-    : db_(db), cardService_(cs), feedback_(fb), running_(false) {
+    : db_(db), cardService_(cs), feedback_(fb), eventStreams_(0), running_(false) {
 }
 
 ApiController::~ApiController() {
     stop();
 }
 
+void ApiController::useEventHub(EventHub* events) {
+    events_ = events;
+}
+
 /* ==================== Set Thread Priority ==================== */
 
 void ApiController::setThreadPriority(pthread_t handle, int priority) {
@@ -49,6 +271,23 @@ void ApiController::start() {
     thNFC_ = thread(&ApiController::nfcThreadFunction, this);
     thWorker_ = thread(&ApiController::workerThreadFunction, this);
     thNetwork_ = thread(&ApiController::networkThreadFunction, this);
+
+    posListenFd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(kPosSocketPort);
+    int one = 1;
+    if (posListenFd_ >= 0 &&
+        setsockopt(posListenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0 &&
+        ::bind(posListenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+        ::listen(posListenFd_, 8) == 0) {
+        thPos_ = thread(&ApiController::posAcceptFunction, this);
+    } else {
+        cerr << "[POS] Port " << kPosSocketPort << " unavailable, WebSocket channel disabled\n";
+        if (posListenFd_ >= 0) ::close(posListenFd_);
+        posListenFd_ = -1;
+    }
     
     // SCHED_FIFO priorities: 1 (lowest) to 99 (highest)
     setThreadPriority(thNFC_.native_handle(), 80);      // High priority
@@ -65,8 +304,29 @@ void ApiController::stop() {
     cout << "[API] Stopping services...\n";
 
     queueCv_.notify_all();
+    {
+        lock_guard<mutex> lock(stateMtx_);
+    }
+    stateCv_.notify_all();
+    if (events_) events_->close();
     server_.stop(); 
 
+    // Wakes accept() and every session blocked in recv()
+    if (posListenFd_ >= 0) shutdown(posListenFd_, SHUT_RDWR);
+    if (thPos_.joinable()) thPos_.join();
+    {
+        lock_guard<mutex> lock(posMtx_);
+        for (PosSession& s : posSessions_) {
+            if (!s.done->load()) shutdown(s.fd, SHUT_RDWR);
+        }
+    }
+    for (PosSession& s : posSessions_) {
+        if (s.th.joinable()) s.th.join();
+    }
+    posSessions_.clear();
+    if (posListenFd_ >= 0) ::close(posListenFd_);
+    posListenFd_ = -1;
+
     if (thNFC_.joinable()) thNFC_.join();
     if (thWorker_.joinable()) thWorker_.join();
     if (thNetwork_.joinable()) thNetwork_.join();
@@ -124,10 +384,9 @@ void ApiController::workerThreadFunction() {
             workQueue_.pop();
         }
 
-        // Query card data from DB
-        CardSummaryDTO summary;
-        db_->setEmployeeViewMode(false); 
-        DbResult res = db_->getCardSummary(uidToProcess, summary);
+        // Status and total come from the card store when it is enabled
+        OpenCardDTO state;
+        DbResult res = cardService_->getCardState(uidToProcess, state);
 
         CachedCardState newState;
         newState.card_id = uidToProcess;
@@ -135,25 +394,240 @@ void ApiController::workerThreadFunction() {
 
         if (res == DbResult::Ok) {
             newState.is_valid_in_db = true;
-            newState.status = summary.status;
-            newState.total_pay = summary.total_to_pay;
+            newState.status = state.status;
+            newState.total_pay = state.total_to_pay;
         } else {
             newState.is_valid_in_db = false;
         }
 
         {
             lock_guard<mutex> lock(stateMtx_);
+            newState.seq = latestCardState_.seq + 1;
             latestCardState_ = newState;
         }
+        stateCv_.notify_all();
+
+        if (events_) {
+            EventDTO ev;
+            ev.type = EventType::Scan;
+            ev.card_id = uidToProcess;
+            ev.result = res;
+            ev.status = newState.status;
+            ev.amount = newState.total_pay;
+            events_->publish(std::move(ev));
+        }
         
         cout << "[Worker] Processed: " << uidToProcess 
              << " (Valid: " << newState.is_valid_in_db << ")\n";
     }
 }
 
+/* ==================== POS WebSocket Channel ==================== */
+
+// Accepts tablets on kPosSocketPort; each session gets its own thread
+void ApiController::posAcceptFunction() {
+    cout << "[POS] WebSocket channel listening on port " << kPosSocketPort << "\n";
+
+    while (running_) {
+        int fd = accept4(posListenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+
+        lock_guard<mutex> lock(posMtx_);
+        // Reap sessions that ended since the last accept
+        for (auto it = posSessions_.begin(); it != posSessions_.end();) {
+            if (it->done->load()) {
+                it->th.join();
+                it = posSessions_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (!running_ || posSessions_.size() >= kMaxPosSessions) {
+            ::close(fd);
+            continue;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        posSessions_.emplace_back();
+        PosSession& s = posSessions_.back();
+        s.fd = fd;
+        s.done = make_shared<atomic<bool>>(false);
+        s.th = thread(&ApiController::posSessionFunction, this, fd, s.done);
+    }
+}
+
+// Commands are handled in arrival order and answered with the request's
+// id, so a tablet may send several without waiting. Scans are pushed on
+// the same socket from a second thread; one lock keeps frames whole.
+void ApiController::posSessionFunction(int fd, shared_ptr<atomic<bool>> done) {
+    mutex writeMtx;
+    auto send = [fd, &writeMtx](ws::Opcode op, const char* data, size_t len) {
+        lock_guard<mutex> lock(writeMtx);
+        return ws::writeFrame(fd, op, data, len);
+    };
+
+    // Nothing a peer sends may escape this thread: an uncaught exception
+    // would terminate the whole backend
+    string path;
+    bool upgraded = false;
+    try {
+        upgraded = ws::acceptHandshake(fd, path, kPosHandshakeTimeout);
+    } catch (const exception& e) {
+        cerr << "[POS] Handshake failed: " << e.what() << "\n";
+    }
+    if (upgraded && path != "/pos") {
+        static const char policy[] = { 0x03, static_cast<char>(0xF0) };    // 1008
+        send(ws::Opcode::Close, policy, sizeof(policy));
+    } else if (upgraded) {
+        atomic<bool> open{true};
+
+        thread pusher;
+        if (events_) {
+            pusher = thread([this, fd, &open, &send] {
+                try {
+                    uint64_t cursor = events_->lastId();
+                    vector<EventDTO> batch;
+                    string msg;
+                    auto lastWrite = chrono::steady_clock::now();
+
+                    while (open && running_) {
+                        if (!events_->waitAfter(cursor, chrono::seconds(1))) {
+                            if (events_->closed()) break;
+                            // Idle: a ping finds tablets that left without closing
+                            if (chrono::steady_clock::now() - lastWrite > chrono::seconds(15)) {
+                                if (!send(ws::Opcode::Ping, nullptr, 0)) break;
+                                lastWrite = chrono::steady_clock::now();
+                            }
+                            continue;
+                        }
+
+                        batch.clear();
+                        if (!events_->since(cursor, batch, 64)) {
+                            // Fell more than a ring behind: the tablet refetches
+                            static const char gap[] = "{\"event\":\"gap\"}";
+                            if (!send(ws::Opcode::Text, gap, sizeof(gap) - 1)) {
+                                open = false;
+                                break;
+                            }
+                        }
+                        for (const EventDTO& ev : batch) {
+                            if (ev.type != EventType::Scan) continue;
+                            msg = "{\"event\":\"scan\",\"seq\":" + to_string(ev.id) + ',';
+                            eventFields(msg, ev);
+                            msg += '}';
+                            if (!send(ws::Opcode::Text, msg.data(), msg.size())) {
+                                open = false;
+                                break;
+                            }
+                            lastWrite = chrono::steady_clock::now();
+                        }
+                    }
+                } catch (const exception& e) {
+                    cerr << "[POS] Scan push failed: " << e.what() << "\n";
+                }
+                // Unblock the reader if the socket died on a write
+                shutdown(fd, SHUT_RDWR);
+            });
+        }
+
+        try {
+            string message;
+            ws::Opcode op;
+            while (running_ && ws::readMessage(fd, message, op, send)) {
+                if (op != ws::Opcode::Text) continue;
+                string reply = posCommand(message);
+                if (!send(ws::Opcode::Text, reply.data(), reply.size())) break;
+            }
+        } catch (const exception& e) {
+            cerr << "[POS] Session dropped: " << e.what() << "\n";
+        }
+
+        open = false;
+        shutdown(fd, SHUT_RDWR);
+        if (pusher.joinable()) pusher.join();
+    }
+
+    // Under the lock, so stop() never shuts down a reused descriptor
+    lock_guard<mutex> lock(posMtx_);
+    ::close(fd);
+    done->store(true);
+}
+
+// {"id":..., "op":"consume"|"cart"|"activate"|"checkout"|"summary", "card_id":..., ...}
+string ApiController::posCommand(const string& message) {
+    json reply;
+    try {
+        auto cmd = json::parse(message);
+        if (cmd.contains("id")) reply["id"] = cmd["id"];
+
+        string op = cmd.at("op");
+        string card_id = cmd.at("card_id");
+        DbResult r;
+
+        if (op == "consume") {
+            r = cardService_->addConsumption(card_id, cmd.at("product_id"), cmd.at("employee_id"),
+                                             cmd.at("quantity"));
+        } else if (op == "cart") {
+            vector<CartLineDTO> lines;
+            for (const auto& item : cmd.at("items")) {
+                lines.push_back({ item.at("product_id").get<int32_t>(), item.at("quantity").get<int32_t>() });
+            }
+            if (lines.empty() || lines.size() > kMaxCartLines) throw invalid_argument("cart size");
+            double total = 0.0;
+            r = cardService_->addConsumptions(card_id, cmd.at("employee_id"), lines, total);
+            if (r == DbResult::Ok) reply["total"] = total;
+        } else if (op == "activate") {
+            const json& phone = cmd.at("phone");
+            r = cardService_->activateCard(card_id, phone.is_string() ? stoi(phone.get<string>()) : phone.get<int>());
+        } else if (op == "checkout") {
+            CheckoutDTO checkout;
+            r = cardService_->deactivateCard(card_id, checkout);
+            if (r == DbResult::Ok) {
+                reply["total"] = checkout.total_paid;
+                reply["lines"] = checkout.lines_closed;
+            }
+        } else if (op == "summary") {
+            CardSummaryDTO summary;
+            r = cardService_->getCardSummary(card_id, summary);
+            if (r == DbResult::Ok) {
+                reply["status"] = string(1, summary.status);
+                reply["phone"] = summary.phone;
+                reply["total"] = summary.total_to_pay;
+                json lines = json::array();
+                for (const auto& l : summary.lines) {
+                    lines.push_back({
+                        {"product_name", l.product_name},
+                        {"quantity", l.qty},
+                        {"unit_price", l.price_unit},
+                        {"total", l.line_total}
+                    });
+                }
+                reply["lines"] = std::move(lines);
+            }
+        } else {
+            reply["ok"] = false;
+            reply["error"] = "unknown op";
+            return reply.dump();
+        }
+
+        reply["ok"] = (r == DbResult::Ok);
+        reply["result"] = resultName(r);
+    } catch (...) {
+        reply["ok"] = false;
+        reply["error"] = "bad request";
+    }
+    return reply.dump();
+}
+
 /* ==================== Network Thread (REST API) ==================== */
 
 void ApiController::networkThreadFunction() {
+    server_.new_task_queue = [] { return new httplib::ThreadPool(kHttpThreads); };
     server_.set_default_headers({
         {"Access-Control-Allow-Origin", "*"},
         {"Access-Control-Allow-Methods", "POST, GET, OPTIONS"},
@@ -183,25 +657,115 @@ void ApiController::networkThreadFunction() {
     });
 
     /* ==================== Wait for Card (Long Polling) ==================== */
-    
-    server_.Get("/wait_card", [this](const auto&, auto& res) {
-        json j; 
+
+    // ?timeout=<ms> blocks until a card is scanned instead of answering at
+    // once; ?after=<seq> (the seq of the last reply) skips scans already
+    // seen. Without timeout the call returns immediately, as before.
+    server_.Get("/wait_card", [this](const auto& req, auto& res) {
+        long timeoutMs = 0;
+        uint64_t after = 0;
+        try {
+            if (req.has_param("timeout")) timeoutMs = stol(req.get_param_value("timeout"));
+            if (req.has_param("after")) after = stoull(req.get_param_value("after"));
+        } catch (...) {
+            res.status = 400;
+            res.set_content("{\"error\":\"Invalid timeout or after\"}", "application/json");
+            return;
+        }
+        timeoutMs = max(0L, min(timeoutMs, kMaxWaitCardMs));
+
+        unique_lock<mutex> lock(stateMtx_);
+        // A seq from before a restart would otherwise hide every new scan
+        if (after > latestCardState_.seq) after = 0;
+
+        // Card is fresh if scanned within last 3 seconds and not yet seen
+        auto fresh = [this, after] {
+            return !latestCardState_.card_id.empty() && latestCardState_.seq > after &&
+                   chrono::steady_clock::now() - latestCardState_.scan_time < chrono::seconds(3);
+        };
+        // Past the cap the current state is returned at once; the client polls again
+        if (timeoutMs > 0 && parkedPolls_ < kMaxParkedPolls) {
+            parkedPolls_++;
+            stateCv_.wait_for(lock, chrono::milliseconds(timeoutMs), [this, &fresh] {
+                return !running_ || fresh();
+            });
+            parkedPolls_--;
+        }
+
+        json j;
         j["card_id"] = nullptr;
-        
-        lock_guard<mutex> lock(stateMtx_);
-        auto now = chrono::steady_clock::now();
-        
-        // Card is fresh if scanned within last 3 seconds
-        if (chrono::duration_cast<chrono::seconds>(now - latestCardState_.scan_time).count() < 3 
-            && !latestCardState_.card_id.empty()) {
-            
+        j["seq"] = latestCardState_.seq;
+        if (fresh()) {
             j["card_id"] = latestCardState_.card_id;
             j["status"] = string(1, latestCardState_.status);
             j["valid"] = latestCardState_.is_valid_in_db;
         }
+        lock.unlock();
         res.set_content(j.dump(), "application/json");
     });
 
+    /* ==================== Event Stream (SSE) ==================== */
+
+    // Scans and card operation outcomes as they happen. A reconnecting
+    // client resumes after Last-Event-ID (or ?last_event_id=) from the
+    // hub's ring; one that fell too far behind first gets a "gap" event and
+    // should refetch its state. Idle streams carry a comment every 15 s.
+    server_.Get("/events", [this](const auto& req, auto& res) {
+        if (events_ == nullptr) {
+            res.status = 503;
+            res.set_content("{\"error\":\"Events disabled\"}", "application/json");
+            return;
+        }
+
+        size_t open = eventStreams_.load();
+        do {
+            if (open >= kMaxEventStreams) {
+                res.status = 503;
+                res.set_header("Retry-After", "5");
+                res.set_content("{\"error\":\"Too many event streams\"}", "application/json");
+                return;
+            }
+        } while (!eventStreams_.compare_exchange_weak(open, open + 1));
+
+        uint64_t cursor = events_->lastId();
+        string last = req.get_header_value("Last-Event-ID");
+        if (last.empty() && req.has_param("last_event_id")) last = req.get_param_value("last_event_id");
+        if (!last.empty()) {
+            try {
+                cursor = stoull(last);
+            } catch (...) {
+            }
+        }
+
+        res.set_header("Cache-Control", "no-cache");
+        res.set_chunked_content_provider("text/event-stream",
+            [this, cursor](size_t, httplib::DataSink& sink) mutable {
+            string buf = "retry: 2000\n\n";
+            vector<EventDTO> batch;
+
+            while (running_) {
+                batch.clear();
+                if (!events_->since(cursor, batch, 64)) {
+                    buf += "event: gap\ndata: {}\n\n";
+                }
+                for (const EventDTO& ev : batch) sseEvent(buf, ev);
+
+                if (!buf.empty()) {
+                    if (!sink.write(buf.data(), buf.size())) return false;
+                    buf.clear();
+                }
+                if (!events_->waitAfter(cursor, chrono::seconds(15))) {
+                    if (events_->closed()) break;
+                    buf = ": keepalive\n\n";
+                }
+            }
+            sink.done();
+            return true;
+        },
+        // Runs however the response ends, including before the first write
+        [this](bool) { eventStreams_--; });
+    });
+
     /* ==================== Activate Card ==================== */
     
     server_.Post("/activate_card", [this](const auto& req, auto& res) {
@@ -239,17 +803,49 @@ void ApiController::networkThreadFunction() {
         }
     });
 
+    // Body: {"card_id", "employee_id", "items": [{"product_id", "quantity"}, ...]}
+    // Every line is applied in one transaction, or none is
+    server_.Post("/add_consumptions", [this](const auto& req, auto& res) {
+        string card_id;
+        int employee_id;
+        vector<CartLineDTO> lines;
+        try {
+            json body = json::parse(req.body);
+            card_id = body.at("card_id");
+            employee_id = body.at("employee_id");
+            for (const auto& item : body.at("items")) {
+                lines.push_back({ item.at("product_id").get<int32_t>(), item.at("quantity").get<int32_t>() });
+            }
+        } catch(...) {
+            res.status = 400;
+            return;
+        }
+        if (lines.empty() || lines.size() > kMaxCartLines) {
+            res.status = 400;
+            res.set_content("{\"error\":\"Cart must have 1 to 100 items\"}", "application/json");
+            return;
+        }
+
+        double total = 0.0;
+        DbResult r = cardService_->addConsumptions(card_id, employee_id, lines, total);
+
+        json j;
+        j["ok"] = (r == DbResult::Ok);
+        j["result"] = resultName(r);
+        if (r == DbResult::Ok) j["total"] = total;
+        res.set_content(j.dump(), "application/json");
+    });
+
     /* ==================== Validate Exit ==================== */
     
     server_.Post("/validate_exit", [this](const auto& req, auto& res) {
         try {
             auto body = json::parse(req.body);
-            CardSummaryDTO sum;
-            db_->setEmployeeViewMode(false);
-            DbResult r = db_->getCardSummary(body["card_id"], sum);
+            OpenCardDTO state;
+            DbResult r = cardService_->getCardState(body["card_id"], state);
             
             json j; 
-            j["closed"] = (r == DbResult::Ok && sum.status == 'D');
+            j["closed"] = (r == DbResult::Ok && state.status == 'D');
             res.set_content(j.dump(), "application/json");
         } catch(...) { 
             res.status = 400; 
@@ -258,7 +854,12 @@ void ApiController::networkThreadFunction() {
 
     /* ==================== Get Products ==================== */
     
-    server_.Get("/products", [this](const auto&, auto& res) {
+    server_.Get("/products", [this](const auto& req, auto& res) {
+        // Read before the list: a change in between only costs a refetch
+        string etag;
+        if (uint64_t v = db_->catalogVersion()) etag = etagOf("p" + to_string(v));
+        if (notModified(req, res, etag)) return;
+
         vector<ProductDTO> p; 
         cardService_->getProductList(p);
         json j = json::array();
@@ -269,6 +870,7 @@ void ApiController::networkThreadFunction() {
                 {"price", i.price_unit}
             });
         }
+        if (!etag.empty()) res.set_header("ETag", etag);
         res.set_content(j.dump(), "application/json");
     });
 
@@ -280,24 +882,49 @@ void ApiController::networkThreadFunction() {
             return; 
         }
         
-        CardSummaryDTO sum;
-        if (cardService_->getCardSummary(req.get_param_value("card_id"), sum) == DbResult::Ok) {
-            json j;
-            j["card_id"] = sum.card_id;
-            j["phone"] = to_string(sum.phone);
-            j["total"] = sum.total_to_pay;
-            
-            json lines = json::array();
-            for(auto& l : sum.lines) {
-                lines.push_back({
-                   {"product_name", l.product_name},
-                   {"quantity", l.qty},
-                   {"unit_price", l.price_unit},
-                   {"total", l.line_total}
-                });
+        // The card, the product names and the phone masking all shape the body
+        string card_id = req.get_param_value("card_id");
+        string etag;
+        uint64_t cardVersion = 0;
+        uint64_t catalogVersion = db_->catalogVersion();
+        if (catalogVersion != 0 && cardService_->cardVersion(card_id, cardVersion)) {
+            etag = etagOf("c" + to_string(cardVersion) + '.' + to_string(catalogVersion) +
+                          (db_->employeeViewMode() ? ".e" : ".o"));
+        }
+        if (notModified(req, res, etag)) return;
+
+        // Written straight from the lines result: one buffer whatever the
+        // number of lines, same keys and order as a json dump
+        CardSummaryView sum;
+        if (cardService_->getCardSummary(card_id, sum) == DbResult::Ok) {
+            string body;
+            body.reserve(80 + static_cast<size_t>(sum.lines.size()) * 96);
+
+            body += "{\"card_id\":";
+            jsonString(body, sum.card_id);
+            body += ",\"lines\":[";
+            bool first = true;
+            for (CardLineRow l : sum.lines) {
+                body += first ? "{\"product_name\":" : ",{\"product_name\":";
+                first = false;
+                jsonString(body, sum.productName(l));
+                body += ",\"quantity\":";
+                body += to_string(l.qty());
+                body += ",\"total\":";
+                jsonNumber(body, l.line_total());
+                body += ",\"unit_price\":";
+                jsonNumber(body, l.price_unit());
+                body += '}';
             }
-            j["lines"] = lines;
-            res.set_content(j.dump(), "application/json");
+            body += "],\"phone\":\"";
+            body += to_string(sum.phone);
+            body += "\",\"total\":";
+            jsonNumber(body, sum.total_to_pay);
+            body += '}';
+
+            // Never let a client cache an older body under the current tag
+            if (!etag.empty() && !sum.maybe_stale) res.set_header("ETag", etag);
+            res.set_content(std::move(body), "application/json");
         } else {
             res.status = 404;
         }
@@ -310,10 +937,15 @@ void ApiController::networkThreadFunction() {
             auto body = json::parse(req.body);
             string card_id = body["card_id"];
 
-            DbResult r = cardService_->deactivateCard(card_id);
+            CheckoutDTO checkout;
+            DbResult r = cardService_->deactivateCard(card_id, checkout);
 
             json j;
             j["ok"] = (r == DbResult::Ok);
+            if (r == DbResult::Ok) {
+                j["total"] = checkout.total_paid;
+                j["lines"] = checkout.lines_closed;
+            }
             res.set_content(j.dump(), "application/json");
 
         } catch(...) {
@@ -324,28 +956,193 @@ void ApiController::networkThreadFunction() {
     /* ==================== Product Totals (Owner Only) ==================== */
 
     server_.Get("/product_totals", [this](const auto& req, auto& res) {
+        string etag;
+        if (uint64_t v = db_->totalsVersion()) etag = etagOf("t" + to_string(v));
+        if (notModified(req, res, etag)) return;
+        if (!etag.empty()) res.set_header("ETag", etag);
+
+        streamJsonArray<TotalsRowDTO>(res,
+            [this](const function<bool(const TotalsRowDTO&)>& sink) { return db_->streamTotals(sink); },
+            [](string& out, const TotalsRowDTO& t) {
+                out += "{\"employee_name\":";
+                jsonString(out, t.employee_username);
+                out += ",\"product_name\":";
+                jsonString(out, t.product_name);
+                out += ",\"total_quantity\":" + to_string(t.qty_total) + ",\"total_revenue\":";
+                jsonNumber(out, t.line_total);
+                out += '}';
+            });
+    });
+
+    // ?minutes=<window, default 60>&bucket=<width in minutes, default 1>
+    server_.Get("/sales_history", [this](const auto& req, auto& res) {
+        int minutes = 60;
+        int bucket = 1;
         try {
-            vector<TotalsRowDTO> totals;
-            DbResult r = db_->getTotals(totals);
+            if (req.has_param("minutes")) minutes = stoi(req.get_param_value("minutes"));
+            if (req.has_param("bucket")) bucket = stoi(req.get_param_value("bucket"));
+        } catch (...) {
+            minutes = 0;
+        }
+        // At most 31 days of minute buckets per request
+        if (minutes <= 0 || minutes > 44640 || bucket <= 0 || bucket > minutes) {
+            res.status = 400;
+            res.set_content("{\"error\":\"Invalid minutes or bucket\"}", "application/json");
+            return;
+        }
 
-            if (r == DbResult::Ok) {
-                json j = json::array();
-                for (auto& t : totals) {
-                    j.push_back({
-                        {"product_name", t.product_name},
-                        {"employee_name", t.employee_username},
-                        {"total_quantity", t.qty_total},
-                        {"total_revenue", t.line_total}
-                    });
-                }
-                res.set_content(j.dump(), "application/json");
-            } else {
-                res.status = 500;
-                res.set_content("{\"error\":\"Failed to retrieve data\"}", "application/json");
+        streamJsonArray<SalesBucketDTO>(res,
+            [this, minutes, bucket](const function<bool(const SalesBucketDTO&)>& sink) {
+                return db_->streamSalesHistory(minutes, bucket, sink);
+            },
+            [](string& out, const SalesBucketDTO& b) {
+                out += "{\"bucket_start\":" + to_string(b.bucket_start) +
+                       ",\"employee_id\":" + to_string(b.employee_id) +
+                       ",\"product_id\":" + to_string(b.product_id) +
+                       ",\"total_quantity\":" + to_string(b.qty_total) + ",\"total_revenue\":";
+                jsonNumber(out, b.line_total);
+                out += '}';
+            });
+    });
+
+    /* ==================== Bulk Import / Export ==================== */
+
+    // Body: one wristband UID per line; ids are parsed as COPY pulls them
+    server_.Post("/import_cards", [this](const auto& req, auto& res) {
+        const string& body = req.body;
+        size_t pos = 0;
+
+        uint64_t inserted = 0, skipped = 0;
+        DbResult r = db_->importCards([&](string& id) {
+            while (pos < body.size()) {
+                size_t end = body.find('\n', pos);
+                if (end == string::npos) end = body.size();
+                id.assign(body, pos, end - pos);
+                pos = end + 1;
+
+                while (!id.empty() && isspace(static_cast<unsigned char>(id.back()))) id.pop_back();
+                if (!id.empty()) return true;
+            }
+            return false;
+        }, inserted, skipped);
+
+        json j;
+        j["ok"] = (r == DbResult::Ok);
+        j["inserted"] = inserted;
+        j["skipped"] = skipped;
+        if (r != DbResult::Ok) res.status = 500;
+        res.set_content(j.dump(), "application/json");
+    });
+
+    server_.Get("/export/consumptions", [this](const auto&, auto& res) {
+        streamCsv<ConsumptionLineDTO>(res,
+            "id_consumption,card_id,product_id,product_name,employee_id,qty,price_unit,line_total\n",
+            [this](const function<bool(const ConsumptionLineDTO&)>& sink) { return db_->exportConsumptions(sink); },
+            [](string& out, const ConsumptionLineDTO& c) {
+                out += to_string(c.id_consumption) + ',';
+                csvField(out, c.card_id);
+                out += ',' + to_string(c.product_id) + ',';
+                csvField(out, c.product_name);
+                out += ',' + to_string(c.employee_id) + ',' + to_string(c.qty) + ',' +
+                       to_string(c.price_unit) + ',' + to_string(c.line_total) + '\n';
+            });
+    });
+
+    server_.Get("/export/product_totals", [this](const auto&, auto& res) {
+        streamCsv<TotalsRowDTO>(res,
+            "product_id,product_name,employee_id,employee_name,total_quantity,total_revenue\n",
+            [this](const function<bool(const TotalsRowDTO&)>& sink) { return db_->exportTotals(sink); },
+            [](string& out, const TotalsRowDTO& t) {
+                out += to_string(t.product_id) + ',';
+                csvField(out, t.product_name);
+                out += ',' + to_string(t.employee_id) + ',';
+                csvField(out, t.employee_username);
+                out += ',' + to_string(t.qty_total) + ',' + to_string(t.line_total) + '\n';
+            });
+    });
+
+    /* ==================== Database Pool Stats ==================== */
+
+    server_.Get("/db_stats/statements", [this](const auto&, auto& res) {
+        json j = json::array();
+        for (const StatementStatsDTO& s : db_->statementStats()) {
+            j.push_back({
+                {"name", s.name},
+                {"calls", s.calls},
+                {"round_trips", s.round_trips},
+                {"rows", s.rows},
+                {"errors", {
+                    {"connection", s.errors_connection},
+                    {"constraint", s.errors_constraint},
+                    {"conflict", s.errors_conflict},
+                    {"other", s.errors_other}
+                }},
+                {"mean_us", s.mean_us},
+                {"p50_us", s.p50_us},
+                {"p90_us", s.p90_us},
+                {"p99_us", s.p99_us},
+                {"max_us", s.max_us}
+            });
+        }
+        res.set_content(j.dump(), "application/json");
+    });
+
+    // Starts a fresh measurement window, e.g. at the doors opening
+    server_.Post("/db_stats/statements/reset", [this](const auto&, auto& res) {
+        db_->resetStatementStats();
+        res.set_content("{\"ok\":true}", "application/json");
+    });
+
+    server_.Get("/db_stats", [this](const auto&, auto& res) {
+        PoolStatsDTO s = db_->poolStats();
+        json j;
+        j["pool_size"] = s.pool_size;
+        j["in_use"] = s.in_use;
+        j["peak_in_use"] = s.peak_in_use;
+        j["leases"] = s.leases;
+        j["lease_timeouts"] = s.lease_timeouts;
+        j["avg_wait_us"] = s.leases ? s.total_wait_us / s.leases : 0;
+        j["max_wait_us"] = s.max_wait_us;
+        j["utilisation"] = s.utilisation;
+        j["schema_version"] = s.schema_version;
+        j["connections_up"] = s.connections_up;
+        j["lease_unavailable"] = s.lease_unavailable;
+        j["probe_failures"] = s.probe_failures;
+        j["reconnects"] = s.reconnects;
+        j["async_up"] = s.async_up;
+        j["async_size"] = s.async_size;
+        j["async_reconnects"] = s.async_reconnects;
+        j["listener_running"] = s.listener_running;
+        j["notifications"] = s.notifications;
+        j["listener_reconnects"] = s.listener_reconnects;
+        j["catalog_version"] = s.catalog_version;
+        j["catalog_reloads"] = s.catalog_reloads;
+        j["totals_reloads"] = s.totals_reloads;
+        j["totals_folds"] = s.totals_folds;
+        if (s.replica_configured) {
+            j["replica_usable"] = s.replica_usable;
+            j["replica_lag_ms"] = s.replica_lag_ms;
+            j["replica_reads"] = s.replica_reads;
+            j["replica_fallbacks"] = s.replica_fallbacks;
+            j["replica_reconnects"] = s.replica_reconnects;
+        }
+
+        CardStoreStatsDTO cs;
+        if (cardService_->storeStats(cs)) {
+            j["store_cards"] = cs.cards;
+            j["store_pending"] = cs.pending;
+            j["store_persisted"] = cs.persisted;
+            j["store_conflicts"] = cs.conflicts;
+            j["store_retries"] = cs.retries;
+            j["store_refreshes"] = cs.refreshes;
+            j["store_misses"] = cs.misses;
+            if (cs.journal) {
+                j["journal_backlog"] = cs.journal_backlog;
+                j["journal_fsyncs"] = cs.journal_fsyncs;
+                j["replay_skipped"] = cs.replay_skipped;
             }
-        } catch(...) {
-            res.status = 500;
         }
+        res.set_content(j.dump(), "application/json");
     });
 
     cout << "[HTTP] Server listening on port 5000\n";
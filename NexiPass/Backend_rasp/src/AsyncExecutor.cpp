@@ -0,0 +1,352 @@
+/* ==================== AsyncExecutor.cpp ==================== */
+
+#include "AsyncExecutor.h"
+#include "Backoff.h"
+#include <iostream>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+using namespace std;
+
+// epoll user data for the wake-up eventfd; slots use their index
+static const uint64_t kWakeTag = UINT64_MAX;
+
+/* ==================== Lifecycle ==================== */
+
+AsyncExecutor::AsyncExecutor(string connString, size_t connections, function<bool(PGconn*)> init)
+    : connString_(std::move(connString)), nConns_(connections > 0 ? connections : 1),
+      init_(std::move(init)), running_(false), inFlight_(0), healthy_(0), reconnects_(0) {
+}
+
+AsyncExecutor::~AsyncExecutor() {
+    stop();
+}
+
+bool AsyncExecutor::start() {
+    if (running_) return true;
+
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epollFd_ < 0 || wakeFd_ < 0) {
+        cerr << "[Async] Failed to create epoll/eventfd\n";
+        stop();
+        return false;
+    }
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = kWakeTag;
+    epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeFd_, &ev);
+
+    // Connections are opened blocking, then switched to non-blocking I/O
+    slots_.resize(nConns_);
+    for (size_t i = 0; i < nConns_; ++i) {
+        Slot& s = slots_[i];
+        s.pg = PQconnectdb(connString_.c_str());
+
+        if (PQstatus(s.pg) != CONNECTION_OK || (init_ && !init_(s.pg)) || PQsetnonblocking(s.pg, 1) != 0) {
+            cerr << "[Async] Connection " << i << " failed\n";
+            stop();
+            return false;
+        }
+
+        s.fd = PQsocket(s.pg);
+        epoll_event sev{};
+        sev.events = EPOLLIN;
+        sev.data.u64 = i;
+        epoll_ctl(epollFd_, EPOLL_CTL_ADD, s.fd, &sev);
+    }
+
+    healthy_ = nConns_;
+    {
+        lock_guard<mutex> lock(pendingMtx_);
+        running_ = true;
+    }
+    loopThread_ = thread(&AsyncExecutor::loop, this);
+    return true;
+}
+
+void AsyncExecutor::stop() {
+    // Flipped under the queue lock: once it is false no submitter can push
+    // a job or touch wakeFd_, so both are safe to drain and close below
+    bool wasRunning;
+    {
+        lock_guard<mutex> lock(pendingMtx_);
+        wasRunning = running_;
+        running_ = false;
+    }
+    if (wasRunning) {
+        uint64_t one = 1;
+        (void)write(wakeFd_, &one, sizeof(one));
+    }
+    if (loopThread_.joinable()) loopThread_.join();
+
+    // Anything still queued or in flight completes as a failure
+    for (Slot& s : slots_) {
+        if (s.busy) finish(s, true);
+        if (s.pg != nullptr) PQfinish(s.pg);
+    }
+    slots_.clear();
+    healthy_ = 0;
+
+    deque<Job> orphaned;
+    {
+        lock_guard<mutex> lock(pendingMtx_);
+        orphaned.swap(pending_);
+    }
+    for (Job& job : orphaned) {
+        if (job.done) job.done(nullptr);
+    }
+
+    if (epollFd_ >= 0) close(epollFd_);
+    if (wakeFd_ >= 0) close(wakeFd_);
+    epollFd_ = wakeFd_ = -1;
+}
+
+/* ==================== Submission ==================== */
+
+void AsyncExecutor::submit(Job job) {
+    {
+        // The eventfd write stays under the lock so stop() cannot close it
+        lock_guard<mutex> lock(pendingMtx_);
+        if (running_) {
+            pending_.push_back(std::move(job));
+            uint64_t one = 1;
+            (void)write(wakeFd_, &one, sizeof(one));
+            return;
+        }
+    }
+    if (job.done) job.done(nullptr);
+}
+
+/* ==================== Event Loop ==================== */
+
+void AsyncExecutor::loop() {
+    epoll_event events[16];
+
+    while (running_) {
+        // Wake periodically while a connection waits for its backoff
+        bool anyBroken = healthy_ < slots_.size();
+        int n = epoll_wait(epollFd_, events, 16, anyBroken ? 250 : -1);
+        if (n < 0) continue;
+
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.u64 == kWakeTag) {
+                uint64_t v;
+                (void)read(wakeFd_, &v, sizeof(v));
+                continue;
+            }
+
+            Slot& slot = slots_[events[i].data.u64];
+            if (slot.resetting) {
+                onResetPoll(slot);
+                continue;
+            }
+            if (!slot.busy) {
+                // Idle socket woke up: absorb notices/EOF without a job
+                if (PQconsumeInput(slot.pg) == 0) markBroken(slot);
+                continue;
+            }
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                markBroken(slot);
+                finish(slot, true);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) onWritable(slot);
+            if (slot.busy && (events[i].events & EPOLLIN)) onReadable(slot);
+        }
+
+        if (anyBroken) heal();
+        dispatch();
+    }
+}
+
+void AsyncExecutor::dispatch() {
+    for (Slot& slot : slots_) {
+        if (slot.busy || slot.broken) continue;
+
+        Job job;
+        {
+            lock_guard<mutex> lock(pendingMtx_);
+            if (pending_.empty()) return;
+            job = std::move(pending_.front());
+            pending_.pop_front();
+        }
+
+        slot.job = std::move(job);
+        slot.busy = true;
+        inFlight_++;
+
+        if (slot.job.send(slot.pg) != 1) {
+            markBroken(slot);
+            finish(slot, true);
+            continue;
+        }
+
+        // Non-blocking send may leave bytes in the output buffer
+        int f = PQflush(slot.pg);
+        if (f < 0) {
+            markBroken(slot);
+            finish(slot, true);
+        } else {
+            watch(slot, f == 1);
+        }
+    }
+
+    // With every connection broken, queued work can never run
+    bool anyHealthy = false;
+    for (const Slot& slot : slots_) anyHealthy = anyHealthy || !slot.broken;
+    if (anyHealthy) return;
+
+    deque<Job> failed;
+    {
+        lock_guard<mutex> lock(pendingMtx_);
+        failed.swap(pending_);
+    }
+    for (Job& job : failed) {
+        if (job.done) job.done(nullptr);
+    }
+}
+
+void AsyncExecutor::onWritable(Slot& slot) {
+    int f = PQflush(slot.pg);
+    if (f < 0) {
+        markBroken(slot);
+        finish(slot, true);
+    } else if (f == 0) {
+        watch(slot, false);
+    }
+}
+
+void AsyncExecutor::onReadable(Slot& slot) {
+    if (PQconsumeInput(slot.pg) == 0) {
+        markBroken(slot);
+        finish(slot, true);
+        return;
+    }
+
+    while (!PQisBusy(slot.pg)) {
+        PGresult* res = PQgetResult(slot.pg);
+        if (res == nullptr) {
+            finish(slot, false);
+            return;
+        }
+        // Keep the first result; anything after it is discarded
+        if (slot.first == nullptr) slot.first = res;
+        else PQclear(res);
+    }
+}
+
+void AsyncExecutor::finish(Slot& slot, bool failed) {
+    PGresult* res = failed ? nullptr : slot.first;
+    if (slot.job.done) slot.job.done(res);
+
+    if (slot.first != nullptr) PQclear(slot.first);
+    slot.first = nullptr;
+    slot.job = Job{};
+    slot.busy = false;
+    if (slot.wantWrite) watch(slot, false);
+    inFlight_--;
+}
+
+void AsyncExecutor::markBroken(Slot& slot) {
+    if (slot.broken) return;
+
+    // Stop watching the socket so a dead peer cannot spin the loop
+    if (slot.fd >= 0) epoll_ctl(epollFd_, EPOLL_CTL_DEL, slot.fd, nullptr);
+    slot.fd = -1;
+    slot.broken = true;
+    slot.wantWrite = false;
+    slot.retryAt = chrono::steady_clock::now() + backoffDelay(slot.failures);
+    healthy_--;
+}
+
+/* ==================== Reconnect ==================== */
+
+void AsyncExecutor::heal() {
+    auto now = chrono::steady_clock::now();
+
+    for (Slot& slot : slots_) {
+        if (!slot.broken || slot.busy || slot.resetting || now < slot.retryAt) continue;
+
+        if (PQresetStart(slot.pg) == 0) {
+            slot.failures++;
+            slot.retryAt = now + backoffDelay(slot.failures);
+            continue;
+        }
+
+        // Connection handshake starts by writing
+        slot.resetting = true;
+        rewatch(slot, EPOLLOUT);
+    }
+}
+
+void AsyncExecutor::onResetPoll(Slot& slot) {
+    switch (PQresetPoll(slot.pg)) {
+        case PGRES_POLLING_READING:
+            rewatch(slot, EPOLLIN);
+            return;
+
+        case PGRES_POLLING_WRITING:
+            rewatch(slot, EPOLLOUT);
+            return;
+
+        case PGRES_POLLING_OK: {
+            // Statements are prepared with a short blocking exchange
+            bool ready = PQsetnonblocking(slot.pg, 0) == 0
+                         && (!init_ || init_(slot.pg))
+                         && PQsetnonblocking(slot.pg, 1) == 0;
+            slot.resetting = false;
+
+            if (ready) {
+                rewatch(slot, EPOLLIN);
+                slot.broken = false;
+                slot.failures = 0;
+                slot.wantWrite = false;
+                healthy_++;
+                reconnects_++;
+                return;
+            }
+            break;
+        }
+
+        default:
+            slot.resetting = false;
+            break;
+    }
+
+    // Failed attempt: unwatch and back off
+    if (slot.fd >= 0) epoll_ctl(epollFd_, EPOLL_CTL_DEL, slot.fd, nullptr);
+    slot.fd = -1;
+    slot.failures++;
+    slot.retryAt = chrono::steady_clock::now() + backoffDelay(slot.failures);
+}
+
+// The socket may change across a reset, so re-register by current fd
+void AsyncExecutor::rewatch(Slot& slot, uint32_t events) {
+    int fd = PQsocket(slot.pg);
+
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.u64 = static_cast<uint64_t>(&slot - slots_.data());
+
+    if (fd != slot.fd) {
+        if (slot.fd >= 0) epoll_ctl(epollFd_, EPOLL_CTL_DEL, slot.fd, nullptr);
+        slot.fd = fd;
+        if (fd >= 0) epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
+    } else if (fd >= 0) {
+        epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
+    }
+}
+
+void AsyncExecutor::watch(Slot& slot, bool wantWrite) {
+    if (slot.wantWrite == wantWrite) return;
+    slot.wantWrite = wantWrite;
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | (wantWrite ? EPOLLOUT : 0);
+    ev.data.u64 = static_cast<uint64_t>(&slot - slots_.data());
+    epoll_ctl(epollFd_, EPOLL_CTL_MOD, slot.fd, &ev);
+}
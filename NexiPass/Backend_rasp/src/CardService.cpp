@@ -11,21 +11,54 @@ CardService::CardService(Database* database, FeedbackController* feedback)
 CardService::~CardService() {
 }
 
+void CardService::useCardStore(CardStore* store, WriteAck ack) {
+    store_ = store;
+    ack_ = ack;
+}
+
+bool CardService::storeStats(CardStoreStatsDTO& out) const {
+    if (store_ == nullptr) return false;
+    out = store_->stats();
+    return true;
+}
+
+void CardService::useEventHub(EventHub* events) {
+    events_ = events;
+}
+
+void CardService::publish(EventType type, const string& nfc_uid, DbResult result, double amount,
+                          int32_t productId, int32_t employeeId, int32_t quantity) {
+    if (events_ == nullptr) return;
+
+    EventDTO ev;
+    ev.type = type;
+    ev.card_id = nfc_uid;
+    ev.result = result;
+    ev.amount = amount;
+    ev.product_id = productId;
+    ev.employee_id = employeeId;
+    ev.quantity = quantity;
+    events_->publish(std::move(ev));
+}
+
 /* ==================== Card Activation ==================== */
 
 DbResult CardService::activateCard(const string& nfc_uid, int phone) {
     if (phone <= 0) {
         feedback_->errorFB();
+        publish(EventType::Activation, nfc_uid, DbResult::ConstraintFailed);
         return DbResult::ConstraintFailed;
     }
 
-    DbResult result = db_->activateCard(nfc_uid, phone);
+    DbResult result = store_ ? store_->activate(nfc_uid, phone, ack_)
+                             : db_->activateCard(nfc_uid, phone);
     
     if (result == DbResult::Ok) {
         feedback_->activateFB();
     } else {
         feedback_->errorFB();
     }
+    publish(EventType::Activation, nfc_uid, result);
     
     return result;
 }
@@ -35,40 +68,105 @@ DbResult CardService::activateCard(const string& nfc_uid, int phone) {
 DbResult CardService::addConsumption(const string& nfc_uid, int32_t productId, int32_t employeeId, int32_t quantity) {
     if (quantity <= 0 || productId <= 0 || employeeId <= 0) {
         feedback_->errorFB();
+        publish(EventType::Consumption, nfc_uid, DbResult::ConstraintFailed, 0.0, productId, employeeId, quantity);
         return DbResult::ConstraintFailed;
     }
 
-    DbResult result = db_->registerConsumption(nfc_uid, productId, employeeId, quantity);
+    // Synchronous wrapper: the query itself runs on the async event loop
+    DbResult result = store_ ? store_->addConsumption(nfc_uid, productId, employeeId, quantity, ack_)
+                             : db_->registerConsumptionAsync(nfc_uid, productId, employeeId, quantity).get();
     
     if (result == DbResult::Ok) {
         feedback_->activateFB();
     } else {
         feedback_->errorFB();
     }
+    publish(EventType::Consumption, nfc_uid, result, 0.0, productId, employeeId, quantity);
     
     return result;
 }
 
+DbResult CardService::addConsumptions(const string& nfc_uid, int32_t employeeId, const vector<CartLineDTO>& lines,
+                                      double& out_total) {
+    bool valid = !lines.empty() && employeeId > 0;
+    for (const auto& line : lines) {
+        if (line.qty <= 0 || line.product_id <= 0) valid = false;
+    }
+
+    DbResult result = DbResult::ConstraintFailed;
+    if (valid) {
+        result = store_ ? store_->addCart(nfc_uid, employeeId, lines, ack_, out_total)
+                        : db_->registerCart(nfc_uid, employeeId, lines, out_total);
+    }
+
+    if (result == DbResult::Ok) {
+        feedback_->activateFB();
+    } else {
+        feedback_->errorFB();
+    }
+    for (const auto& line : lines) {
+        publish(EventType::Consumption, nfc_uid, result, 0.0, line.product_id, employeeId, line.qty);
+    }
+
+    return result;
+}
+
 /* ==================== Card Deactivation (Checkout) ==================== */
 
 DbResult CardService::deactivateCard(const string& nfc_uid) {
-    DbResult result = db_->closeCard(nfc_uid);
+    CheckoutDTO ignored;
+    return deactivateCard(nfc_uid, ignored);
+}
+
+DbResult CardService::deactivateCard(const string& nfc_uid, CheckoutDTO& out_checkout) {
+    DbResult result = store_ ? store_->checkout(nfc_uid, out_checkout, ack_)
+                             : db_->closeCardAsync(nfc_uid, out_checkout).get();
     
     if (result == DbResult::Ok) {
         feedback_->checkoutFB();
     } else {
         feedback_->errorFB();
     }
+    publish(EventType::Checkout, nfc_uid, result, result == DbResult::Ok ? out_checkout.total_paid : 0.0);
     
     return result;
 }
 
 /* ==================== Queries ==================== */
 
+DbResult CardService::getCardState(const string& nfc_uid, OpenCardDTO& out_state) {
+    if (store_) return store_->lookup(nfc_uid, out_state);
+
+    // Scans and exit checks act on the status: never a lagging replica
+    CardSummaryDTO summary;
+    DbResult result = db_->getCardSummaryAsync(nfc_uid, summary, false).get();
+    if (result == DbResult::Ok) {
+        out_state.card_id = summary.card_id;
+        out_state.status = summary.status;
+        out_state.phone = summary.phone;
+        out_state.total_to_pay = summary.total_to_pay;
+        out_state.lines = summary.lines.size();
+    }
+    return result;
+}
+
 DbResult CardService::getCardSummary(const string& nfc_uid, CardSummaryDTO& out_summary) {
-    return db_->getCardSummary(nfc_uid, out_summary);
+    // Lines live in Postgres only: let this card's queued writes land first
+    if (store_) store_->waitPersisted(nfc_uid, chrono::milliseconds(2000));
+    return db_->getCardSummaryAsync(nfc_uid, out_summary).get();
+}
+
+DbResult CardService::getCardSummary(const string& nfc_uid, CardSummaryView& out_summary) {
+    bool persisted = !store_ || store_->waitPersisted(nfc_uid, chrono::milliseconds(2000));
+    DbResult result = db_->getCardSummary(nfc_uid, out_summary);
+    if (!persisted) out_summary.maybe_stale = true;
+    return result;
+}
+
+bool CardService::cardVersion(const string& nfc_uid, uint64_t& out_version) const {
+    return store_ != nullptr && store_->version(nfc_uid, out_version);
 }
 
 DbResult CardService::getProductList(vector<ProductDTO>& out_products) {
-    return db_->listProducts(out_products);
+    return db_->listProductsAsync(out_products).get();
 }
\ No newline at end of file
@@ -0,0 +1,687 @@
+/* ==================== CardStore.cpp ==================== */
+
+#include "CardStore.h"
+#include "ProductCatalog.h"
+#include "Backoff.h"
+#include <iostream>
+
+using namespace std;
+
+// A connection lost mid-statement surfaces as TxError/UnknownError rather
+// than ConnectionError; retry those a few times before calling it a rejection
+static bool shouldRetry(DbResult r, uint32_t& attempts) {
+    if (r == DbResult::ConnectionError) return true;
+    if (r != DbResult::TxError && r != DbResult::UnknownError) return false;
+    return ++attempts < 3;
+}
+
+/* ==================== Lifecycle ==================== */
+
+CardStore::CardStore(Database& db, Journal* journal)
+    : db_(db), journal_(journal), running_(false) {
+}
+
+CardStore::~CardStore() {
+    stop();
+}
+
+bool CardStore::start() {
+    if (running_) return true;
+
+    // Consumption prices come from the catalogue snapshot
+    db_.enableCatalogCache();
+    db_.onNotify(NOTIFY_CHANNEL_CARD, [this](const DbNotification& n) {
+        if (n.resync) invalidateAll();
+        else invalidate(n.payload);
+    });
+
+    // Journaled writes go to Postgres before the warm-up reads it back
+    deque<PendingWrite> backlog;
+    if (journal_) {
+        replayBacklog();
+        backlog.swap(queue_);
+    }
+
+    vector<OpenCardDTO> rows;
+    if (db_.loadOpenCards(rows) == DbResult::Ok) {
+        lock_guard<mutex> lock(mtx_);
+        for (auto& row : rows) {
+            touch(row.card_id);
+            cards_[row.card_id] = std::move(row);
+        }
+        cout << "[CardStore] Loaded " << cards_.size() << " cards\n";
+    } else {
+        cerr << "[CardStore] Warm-up failed, cards will load on first use\n";
+    }
+
+    // Still unreplayed: layer them over what Postgres returned
+    if (!backlog.empty()) {
+        lock_guard<mutex> lock(mtx_);
+        for (auto& w : backlog) {
+            auto it = cards_.find(w.card_id);
+            if (it != cards_.end()) {
+                applyToCard(it->second, w);
+                touch(w.card_id);
+            }
+            queue_.push_back(std::move(w));
+        }
+        cerr << "[CardStore] " << queue_.size() << " journaled writes wait for Postgres\n";
+    }
+
+    running_ = true;
+    writer_ = thread(&CardStore::writerLoop, this);
+    return true;
+}
+
+void CardStore::stop() {
+    if (!running_) return;
+    {
+        lock_guard<mutex> lock(mtx_);
+        running_ = false;
+    }
+    queueCv_.notify_all();
+    if (writer_.joinable()) writer_.join();
+}
+
+/* ==================== Reads ==================== */
+
+// Called with lock held; the lock is released around the opencard read
+DbResult CardStore::findOrLoad(const string& card_id, unique_lock<mutex>& lock, OpenCardDTO*& out) {
+    auto it = cards_.find(card_id);
+    if (it != cards_.end()) {
+        out = &it->second;
+        return DbResult::Ok;
+    }
+
+    lock.unlock();
+    vector<OpenCardDTO> rows;
+    DbResult r = db_.loadOpenCards({ card_id }, rows);
+    lock.lock();
+
+    misses_++;
+    if (r != DbResult::Ok) return r;
+    if (rows.empty()) return DbResult::NotFound;
+
+    // A concurrent miss may have inserted (and already modified) it
+    auto inserted = cards_.emplace(card_id, std::move(rows.front()));
+    if (inserted.second) touch(card_id);
+    out = &inserted.first->second;
+    return DbResult::Ok;
+}
+
+bool CardStore::version(const string& card_id, uint64_t& out) const {
+    lock_guard<mutex> lock(mtx_);
+    auto it = stamps_.find(card_id);
+    if (it == stamps_.end()) return false;
+    out = it->second;
+    return true;
+}
+
+DbResult CardStore::lookup(const string& card_id, OpenCardDTO& out) {
+    unique_lock<mutex> lock(mtx_);
+    OpenCardDTO* card = nullptr;
+    DbResult r = findOrLoad(card_id, lock, card);
+    if (r == DbResult::Ok) out = *card;
+    return r;
+}
+
+/* ==================== Writes ==================== */
+
+// Called with lock held whenever a cached card changes
+void CardStore::touch(const string& card_id) {
+    stamps_[card_id] = ++changeSeq_;
+}
+
+// The single place a write changes a cached card, for live writes and
+// for journal records layered over a warm-up
+void CardStore::applyToCard(OpenCardDTO& card, const PendingWrite& w) {
+    switch (w.kind) {
+        case PendingWrite::Kind::Activate:
+            card.status = 'A';
+            card.phone = w.phone;
+            card.total_to_pay = 0.0;
+            break;
+        case PendingWrite::Kind::Consume:
+            card.total_to_pay += w.price * w.qty;
+            card.lines++;
+            card.qty += static_cast<uint64_t>(w.qty);
+            break;
+        case PendingWrite::Kind::Checkout:
+            card.status = 'D';
+            card.phone = 0;
+            card.total_to_pay = 0.0;
+            card.lines = 0;
+            card.qty = 0;
+            break;
+    }
+}
+
+DbResult CardStore::activate(const string& card_id, int phone, WriteAck ack) {
+    unique_lock<mutex> lock(mtx_);
+    if (!running_) return DbResult::ConnectionError;
+
+    OpenCardDTO* card = nullptr;
+    DbResult r = findOrLoad(card_id, lock, card);
+    if (r != DbResult::Ok) return r;
+
+    // Prevent reactivation if already active
+    if (card->status == 'A') return DbResult::InvalidState;
+
+    PendingWrite w;
+    w.kind = PendingWrite::Kind::Activate;
+    w.card_id = card_id;
+    w.phone = phone;
+
+    r = journalWrite(w);
+    if (r != DbResult::Ok) return r;
+
+    applyToCard(*card, w);
+    touch(card_id);
+    return enqueue(std::move(w), ack, lock);
+}
+
+DbResult CardStore::addConsumption(const string& card_id, int32_t productId, int32_t employeeId,
+                                   int32_t qty, WriteAck ack) {
+    // Outside the store lock: a catalogue reload takes a pooled connection
+    auto cat = db_.catalogSnapshot();
+    const ProductDTO* product = cat ? cat->find(productId) : nullptr;
+    if (product == nullptr) {
+        // Possibly newer than the snapshot; force one reload before refusing
+        db_.invalidateCatalog();
+        cat = db_.catalogSnapshot();
+        product = cat ? cat->find(productId) : nullptr;
+        if (product == nullptr) return cat ? DbResult::ConstraintFailed : DbResult::ConnectionError;
+    }
+
+    unique_lock<mutex> lock(mtx_);
+    if (!running_) return DbResult::ConnectionError;
+
+    OpenCardDTO* card = nullptr;
+    DbResult r = findOrLoad(card_id, lock, card);
+    if (r != DbResult::Ok) return r;
+
+    if (card->status != 'A') return DbResult::InvalidState;
+
+    PendingWrite w;
+    w.kind = PendingWrite::Kind::Consume;
+    w.card_id = card_id;
+    w.productId = productId;
+    w.employeeId = employeeId;
+    w.qty = qty;
+    w.price = product->price_unit;
+
+    r = journalWrite(w);
+    if (r != DbResult::Ok) return r;
+
+    applyToCard(*card, w);
+    touch(card_id);
+    return enqueue(std::move(w), ack, lock);
+}
+
+DbResult CardStore::addCart(const string& card_id, int32_t employeeId, const vector<CartLineDTO>& lines,
+                            WriteAck ack, double& total) {
+    if (lines.empty()) return DbResult::ConstraintFailed;
+
+    auto cat = db_.catalogSnapshot();
+    vector<double> prices;
+    for (int pass = 0; pass < 2; ++pass) {
+        prices.clear();
+        for (const auto& line : lines) {
+            const ProductDTO* product = cat ? cat->find(line.product_id) : nullptr;
+            if (product == nullptr) break;
+            prices.push_back(product->price_unit);
+        }
+        if (prices.size() == lines.size() || pass == 1) break;
+        db_.invalidateCatalog();
+        cat = db_.catalogSnapshot();
+    }
+    if (prices.size() != lines.size()) return cat ? DbResult::ConstraintFailed : DbResult::ConnectionError;
+
+    unique_lock<mutex> lock(mtx_);
+    if (!running_) return DbResult::ConnectionError;
+
+    OpenCardDTO* card = nullptr;
+    DbResult r = findOrLoad(card_id, lock, card);
+    if (r != DbResult::Ok) return r;
+
+    if (card->status != 'A') return DbResult::InvalidState;
+
+    vector<PendingWrite> ws(lines.size());
+    for (size_t i = 0; i < lines.size(); ++i) {
+        ws[i].kind = PendingWrite::Kind::Consume;
+        ws[i].card_id = card_id;
+        ws[i].productId = lines[i].product_id;
+        ws[i].employeeId = employeeId;
+        ws[i].qty = lines[i].qty;
+        ws[i].price = prices[i];
+        ws[i].cartNext = i + 1 < lines.size();
+    }
+
+    if (journal_) {
+        vector<JournalRecordDTO> recs;
+        recs.reserve(ws.size());
+        for (const auto& w : ws) recs.push_back(toRecord(w));
+        if (!journal_->append(recs)) return DbResult::UnknownError;
+        for (size_t i = 0; i < ws.size(); ++i) ws[i].seq = recs[i].seq;
+    }
+
+    for (const auto& w : ws) applyToCard(*card, w);
+    touch(card_id);
+    total = card->total_to_pay;
+    return enqueueCart(ws, ack, lock);
+}
+
+DbResult CardStore::checkout(const string& card_id, CheckoutDTO& out, WriteAck ack) {
+    unique_lock<mutex> lock(mtx_);
+    if (!running_) return DbResult::ConnectionError;
+
+    OpenCardDTO* card = nullptr;
+    DbResult r = findOrLoad(card_id, lock, card);
+    if (r != DbResult::Ok) return r;
+
+    // Already closed: nothing to fold
+    if (card->status == 'D') return DbResult::InvalidState;
+
+    PendingWrite w;
+    w.kind = PendingWrite::Kind::Checkout;
+    w.card_id = card_id;
+
+    r = journalWrite(w);
+    if (r != DbResult::Ok) return r;
+
+    out.card_id = card_id;
+    out.phone = card->phone;
+    out.total_paid = card->total_to_pay;
+    out.lines_closed = card->lines;
+    out.qty_closed = card->qty;
+
+    applyToCard(*card, w);
+    touch(card_id);
+    return enqueue(std::move(w), ack, lock);
+}
+
+// Called with lock held, before memory changes: a write the journal
+// refused is refused outright
+DbResult CardStore::journalWrite(PendingWrite& w) {
+    if (journal_ == nullptr) return DbResult::Ok;
+
+    JournalRecordDTO rec = toRecord(w);
+    if (!journal_->append(rec)) return DbResult::UnknownError;
+    w.seq = rec.seq;
+    return DbResult::Ok;
+}
+
+DbResult CardStore::enqueue(PendingWrite w, WriteAck ack, unique_lock<mutex>& lock) {
+    future<DbResult> persisted;
+    if (ack != WriteAck::Applied) {
+        w.ack = make_shared<promise<DbResult>>();
+        persisted = w.ack->get_future();
+    }
+    uint64_t seq = w.seq;
+
+    pendingByCard_[w.card_id]++;
+    queue_.push_back(std::move(w));
+    lock.unlock();
+    queueCv_.notify_one();
+
+    if (ack == WriteAck::Applied) return DbResult::Ok;
+
+    // A journal that cannot flush degrades to waiting for Postgres
+    if (ack == WriteAck::Journaled && journal_ && journal_->waitDurable(seq)) return DbResult::Ok;
+    return persisted.get();
+}
+
+// Queued back to back under one lock hold, so nothing interleaves a cart
+DbResult CardStore::enqueueCart(vector<PendingWrite>& ws, WriteAck ack, unique_lock<mutex>& lock) {
+    vector<future<DbResult>> persisted;
+    if (ack != WriteAck::Applied) {
+        for (auto& w : ws) {
+            w.ack = make_shared<promise<DbResult>>();
+            persisted.push_back(w.ack->get_future());
+        }
+    }
+    uint64_t lastSeq = ws.back().seq;
+
+    pendingByCard_[ws.front().card_id] += static_cast<uint32_t>(ws.size());
+    for (auto& w : ws) queue_.push_back(std::move(w));
+    lock.unlock();
+    queueCv_.notify_one();
+
+    if (ack == WriteAck::Applied) return DbResult::Ok;
+
+    // One flush covers every line
+    if (ack == WriteAck::Journaled && journal_ && journal_->waitDurable(lastSeq)) return DbResult::Ok;
+
+    DbResult result = DbResult::Ok;
+    for (auto& f : persisted) {
+        DbResult r = f.get();
+        if (result == DbResult::Ok) result = r;
+    }
+    return result;
+}
+
+bool CardStore::waitPersisted(const string& card_id, chrono::milliseconds timeout) {
+    unique_lock<mutex> lock(mtx_);
+    return persistedCv_.wait_for(lock, timeout, [&] {
+        return pendingByCard_.find(card_id) == pendingByCard_.end();
+    });
+}
+
+/* ==================== Invalidation ==================== */
+
+// Runs on the listener thread: only queue the re-read
+void CardStore::invalidate(const string& card_id) {
+    {
+        lock_guard<mutex> lock(mtx_);
+        refresh_.insert(card_id);
+    }
+    queueCv_.notify_one();
+}
+
+void CardStore::invalidateAll() {
+    {
+        lock_guard<mutex> lock(mtx_);
+        refreshAll_ = true;
+    }
+    queueCv_.notify_one();
+}
+
+/* ==================== Writer Thread ==================== */
+
+void CardStore::writerLoop() {
+    uint32_t refreshFailures = 0;
+
+    while (true) {
+        deque<PendingWrite> batch;
+        {
+            unique_lock<mutex> lock(mtx_);
+            queueCv_.wait(lock, [this] {
+                return !queue_.empty() || !refresh_.empty() || refreshAll_ || !running_;
+            });
+            if (!running_ && queue_.empty()) break;
+
+            // A cart is never split across batches
+            while (!queue_.empty() && (batch.size() < batchLimit_ || batch.back().cartNext)) {
+                batch.push_back(std::move(queue_.front()));
+                queue_.pop_front();
+            }
+        }
+
+        // Writes stay at the head of the line until Postgres takes them
+        uint32_t failures = 0;
+        while (persistBatch(batch) > 0) {
+            if (waitRetry(failures++)) continue;
+
+            // Shutting down with Postgres unreachable
+            lock_guard<mutex> lock(mtx_);
+            size_t dropped = batch.size() + queue_.size();
+            for (auto& q : queue_) batch.push_back(std::move(q));
+            queue_.clear();
+            if (journal_) {
+                cerr << "[CardStore] " << dropped << " writes left in the journal for the next start\n";
+            } else {
+                cerr << "[CardStore] Dropping " << dropped << " unpersisted writes\n";
+            }
+            break;
+        }
+        for (auto& w : batch) complete(w, DbResult::ConnectionError);
+
+        if (refreshCards()) {
+            refreshFailures = 0;
+        } else if (!waitRetry(refreshFailures++)) {
+            break;
+        }
+    }
+
+    // Nothing accepts writes any more; release anyone waiting on an ack
+    deque<PendingWrite> left;
+    {
+        lock_guard<mutex> lock(mtx_);
+        left.swap(queue_);
+    }
+    for (auto& w : left) complete(w, DbResult::ConnectionError);
+}
+
+// Persists from the front of the batch in order; returns how many writes
+// are left because Postgres could not be reached
+size_t CardStore::persistBatch(deque<PendingWrite>& batch) {
+    if (journal_) return replayBatch(batch);
+
+    while (!batch.empty()) {
+        PendingWrite& head = batch.front();
+
+        if (head.kind == PendingWrite::Kind::Consume) {
+            // Consecutive consumptions share one pipelined round trip
+            vector<ConsumptionItemDTO> items;
+            for (size_t i = 0; i < batch.size() && batch[i].kind == PendingWrite::Kind::Consume; ++i) {
+                items.push_back({ batch[i].card_id, batch[i].productId, batch[i].employeeId, batch[i].qty });
+            }
+
+            vector<DbResult> results;
+            db_.registerConsumptions(items, results);
+            for (DbResult r : results) {
+                if (shouldRetry(r, batch.front().attempts)) return batch.size();
+                complete(batch.front(), r);
+                batch.pop_front();
+            }
+            continue;
+        }
+
+        DbResult r;
+        if (head.kind == PendingWrite::Kind::Activate) {
+            r = db_.activateCard(head.card_id, head.phone);
+        } else {
+            r = db_.closeCard(head.card_id);
+        }
+        if (shouldRetry(r, head.attempts)) return batch.size();
+
+        complete(head, r);
+        batch.pop_front();
+    }
+    return 0;
+}
+
+void CardStore::complete(PendingWrite& w, DbResult r) {
+    {
+        lock_guard<mutex> lock(mtx_);
+        auto it = pendingByCard_.find(w.card_id);
+        if (it != pendingByCard_.end() && --it->second == 0) {
+            pendingByCard_.erase(it);
+            persistedCv_.notify_all();
+        }
+
+        if (r == DbResult::Ok) {
+            persisted_++;
+        } else if (r != DbResult::ConnectionError) {
+            // Postgres disagrees with memory: it wins, re-read the card
+            conflicts_++;
+            refresh_.insert(w.card_id);
+            cerr << "[CardStore] Write for " << w.card_id << " rejected (" << static_cast<int>(r) << ")\n";
+        }
+    }
+    // A definite answer from Postgres (the batch committed) retires the record
+    if (journal_ && r != DbResult::ConnectionError) journal_->markApplied(w.seq);
+    if (w.ack) w.ack->set_value(r);
+}
+
+// Journal mode: batches go through Database::applyJournal, whose cursor
+// makes a retried batch idempotent. A batch that rolls back is retried one
+// record at a time so a single bad record cannot block the rest.
+size_t CardStore::replayBatch(deque<PendingWrite>& batch) {
+    bool single = false;
+
+    while (!batch.empty()) {
+        size_t n = single ? 1 : min(batch.size(), batchLimit_);
+        while (!single && n < batch.size() && batch[n - 1].cartNext) n++;
+
+        vector<JournalRecordDTO> records;
+        records.reserve(n);
+        for (size_t i = 0; i < n; ++i) records.push_back(toRecord(batch[i]));
+
+        vector<DbResult> results;
+        uint64_t skipped = 0;
+        DbResult r = db_.applyJournal(journal_->source(), records, results, skipped);
+
+        if (r == DbResult::ConnectionError) return batch.size();
+        if (r != DbResult::Ok) {
+            if (n > 1) {
+                single = true;
+                continue;
+            }
+            if (shouldRetry(r, batch.front().attempts)) return batch.size();
+            complete(batch.front(), r);
+            batch.pop_front();
+            continue;
+        }
+
+        if (skipped > 0) {
+            lock_guard<mutex> lock(mtx_);
+            replaySkipped_ += skipped;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            complete(batch.front(), results[i]);
+            batch.pop_front();
+        }
+    }
+    return 0;
+}
+
+// Startup: pushes what the journal still holds, before the warm-up reads
+// opencard. Whatever Postgres did not take is left in queue_.
+void CardStore::replayBacklog() {
+    uint64_t cursor = 0;
+    if (db_.journalCursor(journal_->source(), cursor) == DbResult::Ok) {
+        journal_->reserveThrough(cursor);
+    }
+
+    deque<PendingWrite> batch;
+    for (const auto& rec : journal_->unapplied()) batch.push_back(fromRecord(rec));
+    if (batch.empty()) return;
+
+    {
+        lock_guard<mutex> lock(mtx_);
+        for (const auto& w : batch) pendingByCard_[w.card_id]++;
+    }
+
+    size_t total = batch.size();
+    size_t left = replayBatch(batch);
+    cout << "[CardStore] Replayed " << (total - left) << " of " << total << " journaled writes\n";
+
+    lock_guard<mutex> lock(mtx_);
+    for (auto& w : batch) queue_.push_back(std::move(w));
+}
+
+JournalRecordDTO CardStore::toRecord(const PendingWrite& w) {
+    JournalRecordDTO rec;
+    rec.seq = w.seq;
+    rec.kind = w.kind == PendingWrite::Kind::Activate ? 'A'
+             : w.kind == PendingWrite::Kind::Consume ? 'C' : 'K';
+    rec.card_id = w.card_id;
+    rec.phone = w.phone;
+    rec.product_id = w.productId;
+    rec.employee_id = w.employeeId;
+    rec.qty = w.qty;
+    rec.price_unit = w.price;
+    return rec;
+}
+
+CardStore::PendingWrite CardStore::fromRecord(const JournalRecordDTO& rec) {
+    PendingWrite w;
+    w.kind = rec.kind == 'A' ? PendingWrite::Kind::Activate
+           : rec.kind == 'C' ? PendingWrite::Kind::Consume : PendingWrite::Kind::Checkout;
+    w.card_id = rec.card_id;
+    w.phone = rec.phone;
+    w.productId = rec.product_id;
+    w.employeeId = rec.employee_id;
+    w.qty = rec.qty;
+    w.price = rec.price_unit;
+    w.seq = rec.seq;
+    return w;
+}
+
+// Re-reads invalidated cards; entries with writes still queued are kept
+// for a later pass so memory never regresses behind its own writes
+bool CardStore::refreshCards() {
+    vector<string> ids;
+    bool all;
+    {
+        lock_guard<mutex> lock(mtx_);
+        all = refreshAll_;
+        refreshAll_ = false;
+        ids.assign(refresh_.begin(), refresh_.end());
+        refresh_.clear();
+    }
+    if (!all && ids.empty()) return true;
+
+    vector<OpenCardDTO> rows;
+    DbResult r = all ? db_.loadOpenCards(rows) : db_.loadOpenCards(ids, rows);
+
+    lock_guard<mutex> lock(mtx_);
+    if (r != DbResult::Ok) {
+        refreshAll_ = refreshAll_ || all;
+        refresh_.insert(ids.begin(), ids.end());
+        return false;
+    }
+
+    unordered_map<string, OpenCardDTO> fresh;
+    for (auto& row : rows) fresh.emplace(row.card_id, std::move(row));
+
+    if (all) {
+        ids.clear();
+        for (const auto& kv : cards_) ids.push_back(kv.first);
+        for (const auto& kv : fresh) ids.push_back(kv.first);
+    }
+
+    for (const auto& id : ids) {
+        if (pendingByCard_.count(id) != 0) {
+            refresh_.insert(id);
+            continue;
+        }
+        auto it = fresh.find(id);
+        if (it == fresh.end()) {
+            cards_.erase(id);
+            stamps_.erase(id);
+        } else {
+            // The echo of our own write usually changes nothing
+            OpenCardDTO& card = cards_[id];
+            const OpenCardDTO& row = it->second;
+            if (stamps_.count(id) == 0 || card.status != row.status || card.phone != row.phone ||
+                card.total_to_pay != row.total_to_pay || card.lines != row.lines || card.qty != row.qty) {
+                touch(id);
+            }
+            card = row;
+        }
+        refreshes_++;
+    }
+    return true;
+}
+
+bool CardStore::waitRetry(uint32_t failures) {
+    unique_lock<mutex> lock(mtx_);
+    retries_++;
+    queueCv_.wait_for(lock, backoffDelay(failures), [this] { return !running_; });
+    return running_;
+}
+
+/* ==================== Diagnostics ==================== */
+
+CardStoreStatsDTO CardStore::stats() const {
+    lock_guard<mutex> lock(mtx_);
+    CardStoreStatsDTO s;
+    s.cards = cards_.size();
+    for (const auto& kv : pendingByCard_) s.pending += kv.second;
+    s.persisted = persisted_;
+    s.conflicts = conflicts_;
+    s.retries = retries_;
+    s.refreshes = refreshes_;
+    s.misses = misses_;
+    s.replay_skipped = replaySkipped_;
+
+    if (journal_) {
+        JournalStatsDTO js = journal_->stats();
+        s.journal = true;
+        s.journal_backlog = js.last_seq - min(js.applied_seq, js.last_seq);
+        s.journal_fsyncs = js.fsyncs;
+    }
+    return s;
+}
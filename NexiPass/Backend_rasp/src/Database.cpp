@@ -1,12 +1,589 @@
 #include "Database.h"
+#include "PgDecode.h"
+#include "AsyncExecutor.h"
+#include "Backoff.h"
+#include "ProductCatalog.h"
+#include "TotalsCache.h"
+#include "ReplicaPool.h"
+#include "Schema.h"
 #include <libpq-fe.h>
+#include <unistd.h>
+#include <random>
 #include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+/* Prepared Statement Registry */
+
+// Every statement is parsed and planned once per connection with PQprepare;
+// hot paths then run it with PQexecPrepared by id.
+enum class Stmt : size_t {
+    AuthUser = 0,
+    CardStatus,
+    CardActivate,
+    CardCheckout,
+    ConsumptionApply,
+    ConsumptionApplyPriced,
+    CartApply,
+    CardHeader,
+    CardLines,
+    CardLinesBare,
+    OpenCardsAll,
+    OpenCardsSome,
+    JournalActivate,
+    JournalCursorLock,
+    JournalCursorGet,
+    JournalCursorAdvance,
+    TotalsReport,
+    ProductList,
+    SalesHistory,
+    SaleHistoryPartitions,
+    Count
+};
+
+struct StatementDef {
+    const char* name;
+    const char* sql;
+    int nParams;
+};
+
+static const StatementDef kStatements[] = {
+    { "auth_user",
+      "SELECT user_id, username, password_hash, role FROM users WHERE username = $1", 1 },
+    { "card_status",
+      "SELECT status FROM opencard WHERE card_id = $1", 1 },
+    { "card_activate",
+      "UPDATE opencard SET status = 'A', phone = $1, total_to_pay = 0 WHERE card_id = $2", 2 },
+    // Whole checkout in one atomic statement: lock the card, drain its lines
+    // into producttotals, salehistory and the per-minute rollup, reset it;
+    // returns the pre-checkout card summary and the folded deltas as
+    // 'product:employee:qty:total' items joined by ','
+    { "card_checkout",
+      "WITH card AS ("
+      "  SELECT card_id, phone, status, total_to_pay FROM opencard WHERE card_id = $1 FOR UPDATE"
+      "), lines AS ("
+      "  DELETE FROM openconsumption c USING card "
+      "  WHERE c.card_id = card.card_id AND card.status <> 'D' "
+      "  RETURNING c.card_id, c.product_id, c.employee_id, c.qty, c.line_total, c.consumed_at"
+      "), fold AS ("
+      "  INSERT INTO producttotals (product_id, employee_id, qty_total, line_total) "
+      "  SELECT product_id, employee_id, SUM(qty), SUM(line_total) "
+      "  FROM lines "
+      "  GROUP BY product_id, employee_id "
+      "  ON CONFLICT (product_id, employee_id) "
+      "  DO UPDATE SET "
+      "  qty_total = producttotals.qty_total + EXCLUDED.qty_total, "
+      "  line_total = producttotals.line_total + EXCLUDED.line_total"
+      "), hist AS ("
+      "  INSERT INTO salehistory (sold_at, card_id, product_id, employee_id, qty, line_total) "
+      "  SELECT consumed_at, card_id, product_id, employee_id, qty, line_total FROM lines"
+      "), minute AS ("
+      "  INSERT INTO salesminute (bucket, product_id, employee_id, qty_total, line_total) "
+      "  SELECT date_trunc('minute', consumed_at), product_id, employee_id, SUM(qty), SUM(line_total) "
+      "  FROM lines "
+      "  GROUP BY 1, 2, 3 "
+      "  ON CONFLICT (bucket, product_id, employee_id) "
+      "  DO UPDATE SET "
+      "  qty_total = salesminute.qty_total + EXCLUDED.qty_total, "
+      "  line_total = salesminute.line_total + EXCLUDED.line_total"
+      "), reset AS ("
+      "  UPDATE opencard SET status = 'D', phone = 0, total_to_pay = 0 "
+      "  FROM card WHERE opencard.card_id = card.card_id AND card.status <> 'D'"
+      ") "
+      "SELECT card.status, card.phone, card.total_to_pay, "
+      "(SELECT COUNT(*) FROM lines), (SELECT COALESCE(SUM(qty), 0) FROM lines), "
+      "(SELECT string_agg(g.product_id || ':' || g.employee_id || ':' || g.qty || ':' || g.line_total, ',') "
+      " FROM (SELECT product_id, employee_id, SUM(qty) AS qty, SUM(line_total) AS line_total "
+      "       FROM lines GROUP BY product_id, employee_id) g) "
+      "FROM card", 1 },
+    // Status check, line insert and running-total increment in one atomic
+    // statement; returns (card status, product exists, new total)
+    { "consumption_apply",
+      "WITH card AS ("
+      "  SELECT status FROM opencard WHERE card_id = $1 FOR UPDATE"
+      "), prod AS ("
+      "  SELECT price_unit FROM product WHERE product_id = $2"
+      "), ins AS ("
+      "  INSERT INTO openconsumption (card_id, product_id, employee_id, qty, price_unit) "
+      "  SELECT $1, $2, $3::int, $4::int, prod.price_unit "
+      "  FROM card, prod WHERE card.status = 'A' "
+      "  RETURNING line_total"
+      "), upd AS ("
+      "  UPDATE opencard SET total_to_pay = opencard.total_to_pay + ins.line_total "
+      "  FROM ins WHERE opencard.card_id = $1 "
+      "  RETURNING opencard.total_to_pay"
+      ") "
+      "SELECT (SELECT status FROM card), "
+      "EXISTS (SELECT 1 FROM prod), "
+      "(SELECT total_to_pay FROM upd)", 4 },
+    // Same, with the unit price supplied from the in-memory catalogue
+    { "consumption_apply_priced",
+      "WITH card AS ("
+      "  SELECT status FROM opencard WHERE card_id = $1 FOR UPDATE"
+      "), ins AS ("
+      "  INSERT INTO openconsumption (card_id, product_id, employee_id, qty, price_unit) "
+      "  SELECT $1, $2::int, $3::int, $4::int, $5::numeric "
+      "  FROM card WHERE card.status = 'A' "
+      "  RETURNING line_total"
+      "), upd AS ("
+      "  UPDATE opencard SET total_to_pay = opencard.total_to_pay + ins.line_total "
+      "  FROM ins WHERE opencard.card_id = $1 "
+      "  RETURNING opencard.total_to_pay"
+      ") "
+      "SELECT (SELECT status FROM card), true, "
+      "(SELECT total_to_pay FROM upd)", 5 },
+    // A whole cart for one card: every line goes in, or none does when the
+    // card is not active or any product is unknown. Same reply as above,
+    // with the product flag covering every line.
+    { "cart_apply",
+      "WITH card AS ("
+      "  SELECT status FROM opencard WHERE card_id = $1 FOR UPDATE"
+      "), items AS ("
+      "  SELECT u.product_id, u.qty, p.price_unit "
+      "  FROM unnest($3::int[], $4::int[]) AS u(product_id, qty) "
+      "  LEFT JOIN product p ON p.product_id = u.product_id"
+      "), go AS ("
+      "  SELECT (SELECT status FROM card) = 'A' "
+      "     AND NOT EXISTS (SELECT 1 FROM items WHERE price_unit IS NULL) AS ok"
+      "), ins AS ("
+      "  INSERT INTO openconsumption (card_id, product_id, employee_id, qty, price_unit) "
+      "  SELECT $1, items.product_id, $2::int, items.qty, items.price_unit "
+      "  FROM items, go WHERE go.ok "
+      "  RETURNING line_total"
+      "), upd AS ("
+      "  UPDATE opencard SET total_to_pay = opencard.total_to_pay + (SELECT SUM(line_total) FROM ins) "
+      "  WHERE opencard.card_id = $1 AND EXISTS (SELECT 1 FROM ins) "
+      "  RETURNING opencard.total_to_pay"
+      ") "
+      "SELECT (SELECT status FROM card), "
+      "NOT EXISTS (SELECT 1 FROM items WHERE price_unit IS NULL), "
+      "(SELECT total_to_pay FROM upd)", 4 },
+    { "card_header",
+      "SELECT card_id, phone, status, total_to_pay FROM opencard WHERE card_id = $1", 1 },
+    { "card_lines",
+      "SELECT c.id_consumption, c.card_id, c.product_id, c.employee_id, c.qty, "
+      "c.price_unit, c.line_total, p.product_name "
+      "FROM openconsumption c "
+      "JOIN product p ON p.product_id = c.product_id "
+      "WHERE c.card_id = $1", 1 },
+    // Product names come from the catalogue snapshot instead of a JOIN
+    { "card_lines_bare",
+      "SELECT c.id_consumption, c.card_id, c.product_id, c.employee_id, c.qty, "
+      "c.price_unit, c.line_total "
+      "FROM openconsumption c "
+      "WHERE c.card_id = $1", 1 },
+    // Warm-up and refresh of the in-memory open-card store
+    { "open_cards_all",
+      "SELECT o.card_id, o.status, o.phone, o.total_to_pay, "
+      "COUNT(c.id_consumption), COALESCE(SUM(c.qty), 0) "
+      "FROM opencard o "
+      "LEFT JOIN openconsumption c ON c.card_id = o.card_id "
+      "GROUP BY o.card_id, o.status, o.phone, o.total_to_pay", 0 },
+    { "open_cards_some",
+      "SELECT o.card_id, o.status, o.phone, o.total_to_pay, "
+      "COUNT(c.id_consumption), COALESCE(SUM(c.qty), 0) "
+      "FROM opencard o "
+      "LEFT JOIN openconsumption c ON c.card_id = o.card_id "
+      "WHERE o.card_id = ANY($1::text[]) "
+      "GROUP BY o.card_id, o.status, o.phone, o.total_to_pay", 1 },
+    // Journal replay: activation with its status check in the statement;
+    // returns the status before the update
+    { "journal_activate",
+      "WITH card AS ("
+      "  SELECT status FROM opencard WHERE card_id = $2 FOR UPDATE"
+      "), upd AS ("
+      "  UPDATE opencard SET status = 'A', phone = $1, total_to_pay = 0 "
+      "  FROM card WHERE opencard.card_id = $2 AND card.status <> 'A' "
+      "  RETURNING opencard.card_id"
+      ") "
+      "SELECT (SELECT status FROM card), (SELECT COUNT(*) FROM upd)", 2 },
+    // Creates the source's cursor on first use and locks it for the batch
+    { "journal_cursor_lock",
+      "INSERT INTO journalcursor (source, last_seq) VALUES ($1, 0) "
+      "ON CONFLICT (source) DO UPDATE SET last_seq = journalcursor.last_seq "
+      "RETURNING last_seq", 1 },
+    { "journal_cursor_get",
+      "SELECT last_seq FROM journalcursor WHERE source = $1", 1 },
+    { "journal_cursor_advance",
+      "UPDATE journalcursor SET last_seq = GREATEST(last_seq, $2::bigint) WHERE source = $1", 2 },
+    { "totals_report",
+      "SELECT t.product_id, p.product_name, t.employee_id, u.username, "
+      "t.qty_total, t.line_total "
+      "FROM producttotals t "
+      "JOIN product p ON p.product_id = t.product_id "
+      "JOIN users u ON u.user_id = t.employee_id "
+      "ORDER BY t.product_id, t.employee_id", 0 },
+    { "product_list",
+      "SELECT product_id, product_name, price_unit FROM product ORDER BY product_name", 0 },
+    // Per-minute rollup re-bucketed to $2 minutes over the last $1 minutes;
+    // bucket starts are epoch seconds aligned to the bucket width
+    { "sales_history",
+      "SELECT (floor(extract(epoch FROM bucket) / ($2::int * 60)) * ($2::int * 60))::int8, "
+      "product_id, employee_id, SUM(qty_total)::int8, SUM(line_total) "
+      "FROM salesminute "
+      "WHERE bucket >= date_trunc('minute', now()) - make_interval(mins => $1::int) "
+      "GROUP BY 1, 2, 3 "
+      "ORDER BY 1, 2, 3", 2 },
+    { "sale_history_partitions",
+      "SELECT nexipass_sale_partitions(2)", 0 },
+};
+
+static_assert(sizeof(kStatements) / sizeof(kStatements[0]) == static_cast<size_t>(Stmt::Count),
+              "kStatements must list every Stmt id");
+
+// Identifies this process's sessions to the producttotals trigger, so a
+// nexipass_totals NOTIFY can be told apart from other terminals' checkouts
+static const std::string& writerTag() {
+    static const std::string tag = [] {
+        char buf[48];
+        std::random_device rd;
+        unsigned long long salt = (static_cast<unsigned long long>(rd()) << 32) | rd();
+        snprintf(buf, sizeof(buf), "%d-%016llx", static_cast<int>(getpid()), salt);
+        return std::string(buf);
+    }();
+    return tag;
+}
+
+// Prepares the whole registry on a fresh (or freshly reset) connection
+static bool prepareStatements(PGconn* pg) noexcept {
+    std::string tagSql = "SET nexipass.writer = '" + writerTag() + "'";
+    PGresult* tagRes = PQexec(pg, tagSql.c_str());
+    bool tagged = PQresultStatus(tagRes) == PGRES_COMMAND_OK;
+    PQclear(tagRes);
+    if (!tagged) return false;
+
+    for (const StatementDef& def : kStatements) {
+        PGresult* res = PQprepare(pg, def.name, def.sql, def.nParams, nullptr);
+        bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+        PQclear(res);
+        if (!ok) return false;
+    }
+    return true;
+}
+
+/* Statement Statistics */
+
+// Work outside the registry that is timed as a unit
+enum class Batch : size_t {
+    Transaction = 0,        // BEGIN / COMMIT / ROLLBACK
+    ConsumptionPipeline,
+    JournalPipeline,
+    CopyIn,
+    CardImportMerge,
+    CopyOut,
+    Count
+};
+
+static const char* const kBatchNames[] = {
+    "transaction", "consumption_pipeline", "journal_pipeline", "copy_in", "card_import_merge", "copy_out"
+};
+
+static_assert(sizeof(kBatchNames) / sizeof(kBatchNames[0]) == static_cast<size_t>(Batch::Count),
+              "kBatchNames must name every Batch id");
+
+// Process-wide, like the registry they describe
+static StatementStats gStmtStats[static_cast<size_t>(Stmt::Count)];
+static StatementStats gBatchStats[static_cast<size_t>(Batch::Count)];
+
+static StatementStats& statsOf(Stmt id) { return gStmtStats[static_cast<size_t>(id)]; }
+static StatementStats& statsOf(Batch id) { return gBatchStats[static_cast<size_t>(id)]; }
+
+static uint64_t elapsedUs(std::chrono::steady_clock::time_point since) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - since).count());
+}
+
+static PGresult* execStmt(PGconn* pg, Stmt id, const char* const* params, int resultFormat = 0) noexcept {
+    const StatementDef& def = kStatements[static_cast<size_t>(id)];
+    auto start = std::chrono::steady_clock::now();
+    PGresult* res = PQexecPrepared(pg, def.name, def.nParams, params, nullptr, nullptr, resultFormat);
+    statsOf(id).record(elapsedUs(start), 1, resultRows(res), classifyResult(pg, res));
+    return res;
+}
+
+// Unprepared SQL (transaction control, COPY) timed under a batch tag
+static PGresult* execTimed(PGconn* pg, Batch id, const char* sql) noexcept {
+    auto start = std::chrono::steady_clock::now();
+    PGresult* res = PQexec(pg, sql);
+    statsOf(id).record(elapsedUs(start), 1, resultRows(res), classifyResult(pg, res));
+    return res;
+}
+
+// Maps the consumption_apply reply: unknown card -> NotFound,
+// card not active -> InvalidState, unknown product -> ConstraintFailed
+static DbResult consumptionResult(const PGresult* res) noexcept {
+    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1) {
+        return DbResult::UnknownError;
+    }
+    if (PQgetisnull(res, 0, 0)) return DbResult::NotFound;
+    if (PQgetvalue(res, 0, 0)[0] != 'A') return DbResult::InvalidState;
+    if (PQgetvalue(res, 0, 1)[0] != 't') return DbResult::ConstraintFailed;
+    if (PQgetisnull(res, 0, 2)) return DbResult::UnknownError;
+    return DbResult::Ok;
+}
+
+// Encoded parameters for one consumption. When the catalogue knows the
+// product its price is sent along and the statement skips the lookup.
+struct ConsumptionArgs {
+    Stmt id = Stmt::ConsumptionApply;
+    std::string cardId, prodId, empId, qty, price;
+    const char* params[5] = {};
+
+    ConsumptionArgs(const CatalogSnapshot* cat, const std::string& card, int32_t productId,
+                    int32_t employeeId, int32_t quantity)
+        : cardId(card), prodId(std::to_string(productId)),
+          empId(std::to_string(employeeId)), qty(std::to_string(quantity)) {
+        const ProductDTO* p = cat ? cat->find(productId) : nullptr;
+        if (p != nullptr) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%.15g", p->price_unit);
+            price = buf;
+            id = Stmt::ConsumptionApplyPriced;
+        }
+    }
+
+    // Price fixed by the caller, e.g. the one charged when a journaled sale was accepted
+    ConsumptionArgs(double priceUnit, const std::string& card, int32_t productId,
+                    int32_t employeeId, int32_t quantity)
+        : id(Stmt::ConsumptionApplyPriced), cardId(card), prodId(std::to_string(productId)),
+          empId(std::to_string(employeeId)), qty(std::to_string(quantity)) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.15g", priceUnit);
+        price = buf;
+    }
+
+    // Pointers are bound once the object has its final address
+    const char* const* bind() {
+        params[0] = cardId.c_str();
+        params[1] = prodId.c_str();
+        params[2] = empId.c_str();
+        params[3] = qty.c_str();
+        params[4] = price.c_str();
+        return params;
+    }
+
+    std::vector<std::string> owned() const {
+        if (id == Stmt::ConsumptionApplyPriced) return { cardId, prodId, empId, qty, price };
+        return { cardId, prodId, empId, qty };
+    }
+};
+
+// Text-format array literal; every element is quoted and escaped
+static std::string toTextArray(const std::vector<std::string>& items) {
+    std::string out = "{";
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (i > 0) out += ',';
+        out += '"';
+        for (char c : items[i]) {
+            if (c == '"' || c == '\\') out += '\\';
+            out += c;
+        }
+        out += '"';
+    }
+    out += '}';
+    return out;
+}
+
+/* Result Decoders (shared by the blocking and async paths) */
+
+// Keeps a checkout counted as in flight by the totals cache from before it
+// is sent until its fold; a reseed overlapping it is then not installed
+class CheckoutScope {
+private:
+    TotalsCache* totals_;
+
+public:
+    explicit CheckoutScope(TotalsCache* totals) noexcept : totals_(totals) {
+        if (totals_) totals_->beginCheckout();
+    }
+    ~CheckoutScope() {
+        if (totals_) totals_->endCheckout();
+    }
+
+    CheckoutScope(const CheckoutScope&) = delete;
+    CheckoutScope& operator=(const CheckoutScope&) = delete;
+};
+
+static DbResult checkoutResult(const PGresult* res, const std::string& card_id, CheckoutDTO& out) noexcept {
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) return DbResult::TxError;
+    if (PQntuples(res) == 0) return DbResult::NotFound;
+
+    // Already closed: nothing was touched
+    if (PQgetvalue(res, 0, 0)[0] == 'D') return DbResult::InvalidState;
+
+    out.card_id = card_id;
+    out.phone = static_cast<int>(pgdecode::asInt(res, 0, 1));
+    out.total_paid = pgdecode::asDouble(res, 0, 2);
+    out.lines_closed = static_cast<uint64_t>(pgdecode::asInt(res, 0, 3));
+    out.qty_closed = static_cast<uint64_t>(pgdecode::asInt(res, 0, 4));
+
+    // text in either result format
+    std::string folded;
+    pgdecode::assignText(folded, res, 0, 5);
+    out.folded.clear();
+    for (size_t pos = 0; pos < folded.size();) {
+        size_t end = folded.find(',', pos);
+        if (end == std::string::npos) end = folded.size();
+
+        TotalsRowDTO d;
+        unsigned long long qty = 0;
+        std::string item = folded.substr(pos, end - pos);
+        if (sscanf(item.c_str(), "%d:%d:%llu:%lf", &d.product_id, &d.employee_id, &qty, &d.line_total) == 4) {
+            d.qty_total = qty;
+            out.folded.push_back(std::move(d));
+        }
+        pos = end + 1;
+    }
+    return DbResult::Ok;
+}
+
+// Maps the journal_activate reply like activateCard does
+static DbResult journalActivateResult(const PGresult* res) noexcept {
+    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1) return DbResult::UnknownError;
+    if (PQgetisnull(res, 0, 0)) return DbResult::NotFound;
+    if (pgdecode::asChar(res, 0, 0) == 'A') return DbResult::InvalidState;
+    return DbResult::Ok;
+}
+
+static DbResult decodeOpenCards(const PGresult* res, std::vector<OpenCardDTO>& out) noexcept {
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) return DbResult::UnknownError;
+
+    int nRows = PQntuples(res);
+    out.clear();
+    out.reserve(nRows);
+
+    for (int i = 0; i < nRows; ++i) {
+        OpenCardDTO card;
+        pgdecode::assignText(card.card_id, res, i, 0);
+        card.status = pgdecode::asChar(res, i, 1);
+        card.phone = static_cast<int>(pgdecode::asInt(res, i, 2));
+        card.total_to_pay = pgdecode::asDouble(res, i, 3);
+        card.lines = static_cast<uint64_t>(pgdecode::asInt(res, i, 4));
+        card.qty = static_cast<uint64_t>(pgdecode::asInt(res, i, 5));
+        out.push_back(std::move(card));
+    }
+    return DbResult::Ok;
+}
+
+static DbResult decodeCardHeader(const PGresult* res, bool hidePhone, CardSummaryDTO& out) noexcept {
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) return DbResult::UnknownError;
+    if (PQntuples(res) == 0) return DbResult::NotFound;
+    if (PQnfields(res) < 4) return DbResult::UnknownError;
+
+    pgdecode::assignText(out.card_id, res, 0, 0);
+    
+    // Hide phone number based on privacy setting
+    out.phone = hidePhone ? 0 : static_cast<int>(pgdecode::asInt(res, 0, 1));
+    out.status = pgdecode::asChar(res, 0, 2);
+    out.total_to_pay = pgdecode::asDouble(res, 0, 3);
+    return DbResult::Ok;
+}
+
+// With a catalogue the result comes from card_lines_bare and names are
+// looked up in memory; namesMissing reports a product the snapshot lacks
+static DbResult decodeCardLines(const PGresult* res, CardSummaryDTO& out,
+                                const CatalogSnapshot* cat = nullptr, bool* namesMissing = nullptr) noexcept {
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) return DbResult::UnknownError;
+    if (namesMissing) *namesMissing = false;
 
-Database::Database(std::string connString)
-    : connString_(std::move(connString)), conn_(nullptr), employeeViewMode_(true) { 
+    int nRows = PQntuples(res);
+    out.lines.clear();
+    out.lines.reserve(nRows);
+
+    for (int i = 0; i < nRows; ++i) {
+        out.lines.emplace_back();
+        ConsumptionLineDTO& line = out.lines.back();
+        
+        line.id_consumption = static_cast<uint64_t>(pgdecode::asInt(res, i, 0));
+        line.card_id = out.card_id;
+        line.product_id = static_cast<int>(pgdecode::asInt(res, i, 2));
+        line.employee_id = static_cast<int>(pgdecode::asInt(res, i, 3));
+        line.qty = static_cast<int>(pgdecode::asInt(res, i, 4));
+        line.price_unit = pgdecode::asDouble(res, i, 5);
+        line.line_total = pgdecode::asDouble(res, i, 6);
+
+        if (cat == nullptr) {
+            pgdecode::assignText(line.product_name, res, i, 7);
+        } else if (const ProductDTO* p = cat->find(line.product_id)) {
+            line.product_name = p->name;
+        } else if (namesMissing) {
+            *namesMissing = true;
+        }
+    }
+    return DbResult::Ok;
+}
+
+static void decodeTotalsRow(const PGresult* res, int i, TotalsRowDTO& row) noexcept {
+    row.product_id = static_cast<int>(pgdecode::asInt(res, i, 0));
+    pgdecode::assignText(row.product_name, res, i, 1);
+    row.employee_id = static_cast<int>(pgdecode::asInt(res, i, 2));
+    pgdecode::assignText(row.employee_username, res, i, 3);
+    row.qty_total = static_cast<uint64_t>(pgdecode::asInt(res, i, 4));
+    row.line_total = pgdecode::asDouble(res, i, 5);
+}
+
+static DbResult decodeTotals(const PGresult* res, std::vector<TotalsRowDTO>& out) noexcept {
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) return DbResult::UnknownError;
+
+    int nRows = PQntuples(res);
+    out.clear();
+    out.reserve(nRows);
+
+    for (int i = 0; i < nRows; ++i) {
+        out.emplace_back();
+        decodeTotalsRow(res, i, out.back());
+    }
+    return DbResult::Ok;
+}
+
+static void decodeSalesRow(const PGresult* res, int i, SalesBucketDTO& row) noexcept {
+    row.bucket_start = pgdecode::asInt(res, i, 0);
+    row.product_id = static_cast<int>(pgdecode::asInt(res, i, 1));
+    row.employee_id = static_cast<int>(pgdecode::asInt(res, i, 2));
+    row.qty_total = static_cast<uint64_t>(pgdecode::asInt(res, i, 3));
+    row.line_total = pgdecode::asDouble(res, i, 4);
+}
+
+static DbResult decodeSales(const PGresult* res, std::vector<SalesBucketDTO>& out) noexcept {
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) return DbResult::UnknownError;
+
+    int nRows = PQntuples(res);
+    out.clear();
+    out.reserve(nRows);
+
+    for (int i = 0; i < nRows; ++i) {
+        out.emplace_back();
+        decodeSalesRow(res, i, out.back());
+    }
+    return DbResult::Ok;
+}
+
+static DbResult decodeProducts(const PGresult* res, std::vector<ProductDTO>& out) noexcept {
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) return DbResult::UnknownError;
+    
+    int nRows = PQntuples(res);
+    out.clear();
+    out.reserve(nRows);
+    
+    for (int i = 0; i < nRows; ++i) {
+        out.emplace_back();
+        ProductDTO& prod = out.back();
+        prod.product_id = static_cast<int>(pgdecode::asInt(res, i, 0));
+        pgdecode::assignText(prod.name, res, i, 1);
+        prod.price_unit = pgdecode::asDouble(res, i, 2);
+    }
+    return DbResult::Ok;
+}
+
+Database::Database(std::string connString, size_t poolSize)
+    : connString_(std::move(connString)), employeeViewMode_(true),
+      poolSize_(poolSize > 0 ? poolSize : 1), leaseTimeout_(2000) { 
 }
 
 Database::~Database() {
+    stopListener();
+    stopSupervisor();
+    stopAsync();
     close();
 }
 
@@ -14,24 +591,55 @@ Database::~Database() {
 
 DbResult Database::connect() noexcept {
     try {
-        if (conn_ != nullptr) {
-            PGconn* pg = static_cast<PGconn*>(conn_);
-            // Check if existing connection is still healthy
-            if (PQstatus(pg) == CONNECTION_OK) {
-                return DbResult::Ok;
+        std::lock_guard<std::mutex> lock(poolMtx_);
+
+        if (!pool_.empty()) {
+            // Pool already open: reset any idle connection that went bad
+            bool allOk = true;
+            for (size_t slot : freeSlots_) {
+                PGconn* pg = static_cast<PGconn*>(pool_[slot]);
+                if (PQstatus(pg) == CONNECTION_OK) continue;
+                PQreset(pg);
+                // A reset connection starts a new session without our statements
+                bool up = PQstatus(pg) == CONNECTION_OK && prepareStatements(pg);
+                health_[slot].down = !up;
+                if (!up) allOk = false;
             }
-            PQfinish(pg);
-            conn_ = nullptr;
+            return allOk ? DbResult::Ok : DbResult::ConnectionError;
         }
 
-        PGconn* pg = PQconnectdb(connString_.c_str());
-        
-        if (PQstatus(pg) != CONNECTION_OK) {
-            PQfinish(pg);
-            return DbResult::ConnectionError;
+        std::vector<void*> opened;
+        opened.reserve(poolSize_);
+
+        // The first connection brings the schema up to date before any
+        // statement is prepared against it
+        SchemaStatusDTO schema;
+        for (size_t i = 0; i < poolSize_; ++i) {
+            PGconn* pg = PQconnectdb(connString_.c_str());
+
+            bool up = PQstatus(pg) == CONNECTION_OK && (i > 0 || migrateSchema(pg, schema));
+            if (!up || !prepareStatements(pg)) {
+                PQfinish(pg);
+                for (void* c : opened) PQfinish(static_cast<PGconn*>(c));
+                return DbResult::ConnectionError;
+            }
+            opened.push_back(static_cast<void*>(pg));
         }
 
-        conn_ = static_cast<void*>(pg);
+        pool_ = std::move(opened);
+        leasedAt_.assign(pool_.size(), std::chrono::steady_clock::time_point{});
+        health_.assign(pool_.size(), SlotHealth{});
+        freeSlots_.clear();
+        for (size_t i = pool_.size(); i-- > 0;) freeSlots_.push_back(i);
+
+        poolSince_ = std::chrono::steady_clock::now();
+        schemaVersion_ = schema.version;
+        peakInUse_ = 0;
+        leases_ = leaseTimeouts_ = totalWaitUs_ = maxWaitUs_ = busyUs_ = leaseUnavailable_ = 0;
+        probeFailures_ = reconnects_ = 0;
+
+        // A replica that is down now is picked up later by the supervisor
+        if (replica_) replica_->connect();
         return DbResult::Ok;
         
     } catch (...) {
@@ -40,30 +648,277 @@ DbResult Database::connect() noexcept {
 }
 
 void Database::close() noexcept {
-    if (conn_ != nullptr) {
-        PGconn* pg = static_cast<PGconn*>(conn_);
-        PQfinish(pg);
-        conn_ = nullptr;
-    }
+    stopSupervisor();
+    if (replica_) replica_->close();
+    std::unique_lock<std::mutex> lock(poolMtx_);
+
+    // Let in-flight queries hand their connections back first
+    poolCv_.wait(lock, [this] { return freeSlots_.size() == pool_.size(); });
+
+    for (void* c : pool_) PQfinish(static_cast<PGconn*>(c));
+    pool_.clear();
+    freeSlots_.clear();
+    leasedAt_.clear();
+    health_.clear();
+    poolCv_.notify_all();
 }
 
 bool Database::isAlive() const noexcept {
-    if (conn_ == nullptr) return false;
-    PGconn* pg = static_cast<PGconn*>(conn_);
-    return PQstatus(pg) == CONNECTION_OK;
+    std::lock_guard<std::mutex> lock(poolMtx_);
+    for (void* c : pool_) {
+        if (PQstatus(static_cast<PGconn*>(c)) == CONNECTION_OK) return true;
+    }
+    return false;
+}
+
+/* Connection Pool */
+
+bool Database::acquireSlot(size_t& slot) noexcept {
+    auto t0 = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(poolMtx_);
+
+    auto anyUp = [this] {
+        for (const SlotHealth& h : health_) {
+            if (!h.down) return true;
+        }
+        return false;
+    };
+    auto freeUp = [this] {
+        for (size_t i = freeSlots_.size(); i-- > 0;) {
+            if (!health_[freeSlots_[i]].down) return i;
+        }
+        return freeSlots_.size();
+    };
+
+    if (pool_.empty()) return false;
+
+    // Everything is down: fail now instead of parking the caller
+    if (!anyUp()) {
+        leaseUnavailable_++;
+        return false;
+    }
+
+    bool ready = poolCv_.wait_for(lock, leaseTimeout_, [&] {
+        return freeUp() < freeSlots_.size() || pool_.empty() || !anyUp();
+    });
+
+    auto now = std::chrono::steady_clock::now();
+    uint64_t waitUs = std::chrono::duration_cast<std::chrono::microseconds>(now - t0).count();
+    totalWaitUs_ += waitUs;
+    if (waitUs > maxWaitUs_) maxWaitUs_ = waitUs;
+
+    size_t idx = freeUp();
+    if (!ready || pool_.empty() || idx == freeSlots_.size()) {
+        if (ready) leaseUnavailable_++;
+        else leaseTimeouts_++;
+        return false;
+    }
+
+    slot = freeSlots_[idx];
+    freeSlots_.erase(freeSlots_.begin() + idx);
+    leasedAt_[slot] = now;
+    leases_++;
+
+    size_t inUse = pool_.size() - freeSlots_.size();
+    if (inUse > peakInUse_) peakInUse_ = inUse;
+    return true;
+}
+
+void Database::releaseSlot(size_t slot) noexcept {
+    bool broken = PQstatus(static_cast<PGconn*>(pool_[slot])) != CONNECTION_OK;
+    {
+        std::lock_guard<std::mutex> lock(poolMtx_);
+        auto held = std::chrono::steady_clock::now() - leasedAt_[slot];
+        busyUs_ += std::chrono::duration_cast<std::chrono::microseconds>(held).count();
+        freeSlots_.push_back(slot);
+
+        // Hand the dead connection to the supervisor right away
+        if (broken && !health_[slot].down) {
+            health_[slot].down = true;
+            health_[slot].retryAt = std::chrono::steady_clock::now();
+        }
+    }
+    poolCv_.notify_all();
+    if (broken) superviseCv_.notify_one();
+}
+
+/* Supervisor */
+
+void Database::startSupervisor(std::chrono::milliseconds probeInterval) {
+    if (supervising_) return;
+    {
+        std::lock_guard<std::mutex> lock(poolMtx_);
+        probeInterval_ = probeInterval;
+    }
+    supervising_ = true;
+    supervisor_ = std::thread(&Database::superviseLoop, this);
+}
+
+void Database::stopSupervisor() {
+    if (!supervising_) return;
+    {
+        std::lock_guard<std::mutex> lock(poolMtx_);
+        supervising_ = false;
+    }
+    superviseCv_.notify_all();
+    if (supervisor_.joinable()) supervisor_.join();
+}
+
+void Database::superviseLoop() {
+    auto lastProbe = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point lastHousekeeping{};
+
+    while (supervising_) {
+        size_t n;
+        {
+            std::unique_lock<std::mutex> lock(poolMtx_);
+            auto wake = lastProbe + probeInterval_;
+            for (const SlotHealth& h : health_) {
+                if (h.down && h.retryAt < wake) wake = h.retryAt;
+            }
+            superviseCv_.wait_until(lock, wake, [this, wake] {
+                if (!supervising_) return true;
+                auto t = std::chrono::steady_clock::now();
+                if (t >= wake) return true;
+                for (const SlotHealth& h : health_) {
+                    if (h.down && h.retryAt <= t) return true;
+                }
+                return false;
+            });
+            n = pool_.size();
+        }
+        if (!supervising_) break;
+
+        // Healthy connections are probed once per interval; down ones
+        // whenever their backoff expires
+        auto now = std::chrono::steady_clock::now();
+        bool probeHealthy = now - lastProbe >= probeInterval_;
+        if (probeHealthy) lastProbe = now;
+
+        for (size_t slot = 0; slot < n && supervising_; ++slot) superviseSlot(slot, probeHealthy);
+        if (probeHealthy && replica_) replica_->probe();
+
+        if (probeHealthy && now - lastHousekeeping >= housekeepingInterval_) {
+            lastHousekeeping = now;
+            housekeeping();
+        }
+    }
+}
+
+// Slow-moving maintenance a terminal that stays up for months still needs
+void Database::housekeeping() noexcept {
+    Lease lease(*this);
+    if (!lease) return;
+
+    // Next months' sale history partitions; best effort, the default
+    // partition takes the rows if this never runs
+    PGresult* res = execStmt(lease.get(), Stmt::SaleHistoryPartitions, nullptr);
+    PQclear(res);
+}
+
+void Database::superviseSlot(size_t slot, bool probeHealthy) {
+    PGconn* pg;
+    bool down;
+    {
+        // Only idle connections are probed; take this one out of the free list
+        std::lock_guard<std::mutex> lock(poolMtx_);
+        if (slot >= pool_.size()) return;
+        auto it = std::find(freeSlots_.begin(), freeSlots_.end(), slot);
+        if (it == freeSlots_.end()) return;
+
+        SlotHealth& h = health_[slot];
+        if (!h.down && !probeHealthy) return;
+        if (h.down && std::chrono::steady_clock::now() < h.retryAt) return;
+
+        freeSlots_.erase(it);
+        pg = static_cast<PGconn*>(pool_[slot]);
+        down = h.down;
+    }
+
+    bool probeFailed = false;
+    if (!down) {
+        // Empty query: one round trip, no parse/plan work on the server
+        PGresult* res = PQexec(pg, "");
+        probeFailed = PQresultStatus(res) != PGRES_EMPTY_QUERY || PQstatus(pg) != CONNECTION_OK;
+        PQclear(res);
+    }
+
+    bool reconnected = false;
+    if (down || probeFailed) {
+        PQreset(pg);
+        reconnected = PQstatus(pg) == CONNECTION_OK && prepareStatements(pg);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(poolMtx_);
+        SlotHealth& h = health_[slot];
+
+        if (probeFailed) probeFailures_++;
+
+        if (!down && !probeFailed) {
+            h.failures = 0;
+        } else if (reconnected) {
+            if (h.down || probeFailed) reconnects_++;
+            h.down = false;
+            h.failures = 0;
+        } else {
+            h.down = true;
+            h.retryAt = std::chrono::steady_clock::now() + backoffDelay(h.failures);
+            h.failures++;
+        }
+        freeSlots_.push_back(slot);
+    }
+    poolCv_.notify_all();
+}
+
+Database::Lease::Lease(Database& db) noexcept
+    : db_(db), slot_(0), pg_(nullptr) {
+    if (db_.acquireSlot(slot_)) {
+        pg_ = static_cast<PGconn*>(db_.pool_[slot_]);
+    }
+}
+
+Database::Lease::~Lease() {
+    if (pg_ != nullptr) db_.releaseSlot(slot_);
+}
+
+Database::Lease::operator bool() const noexcept {
+    return pg_ != nullptr && PQstatus(pg_) == CONNECTION_OK;
+}
+
+Database::ReadLease::ReadLease(Database& db, bool replicaOk) noexcept
+    : db_(db), replica_(nullptr) {
+    if (replicaOk && db_.replica_) replica_ = db_.replica_->acquire(db_.leaseTimeout_);
+    if (replica_ == nullptr) primary_.emplace(db_);
+}
+
+Database::ReadLease::~ReadLease() {
+    if (replica_ != nullptr) db_.replica_->release(replica_);
+}
+
+PGconn* Database::ReadLease::get() const noexcept {
+    return replica_ != nullptr ? replica_ : primary_->get();
+}
+
+Database::ReadLease::operator bool() const noexcept {
+    if (replica_ != nullptr) return PQstatus(replica_) == CONNECTION_OK;
+    return static_cast<bool>(*primary_);
+}
+
+bool Database::replicaUsable() const noexcept {
+    return replica_ && replica_->usable();
 }
 
 /* Authentication Logic */
 
 DbResult Database::authenticateUser(const std::string& username, const std::string& password, UserDTO& outUser) noexcept {
-    if (!isAlive()) return DbResult::ConnectionError;
-    
-    PGconn* pg = static_cast<PGconn*>(conn_);
+    Lease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    PGconn* pg = lease.get();
     const char* paramValues[1] = { username.c_str() };
     
-    PGresult* res = PQexecParams(pg,
-        "SELECT user_id, username, password_hash, role FROM users WHERE username = $1",
-        1, nullptr, paramValues, nullptr, nullptr, 0);
+    PGresult* res = execStmt(pg, Stmt::AuthUser, paramValues);
 
     if (PQresultStatus(res) != PGRES_TUPLES_OK) {
         PQclear(res);
@@ -94,14 +949,13 @@ DbResult Database::authenticateUser(const std::string& username, const std::stri
 /* Card Operations */
 
 DbResult Database::activateCard(const std::string& card_id, int phone) noexcept {
-    if (!isAlive()) return DbResult::ConnectionError;
-        
-    PGconn* pg = static_cast<PGconn*>(conn_);
+    Lease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    PGconn* pg = lease.get();
     const char* checkParams[1] = { card_id.c_str() };
     
-    PGresult* res = PQexecParams(pg,
-        "SELECT status FROM opencard WHERE card_id = $1",
-        1, nullptr, checkParams, nullptr, nullptr, 0);
+    PGresult* res = execStmt(pg, Stmt::CardStatus, checkParams);
 
     if (PQresultStatus(res) != PGRES_TUPLES_OK) {
         PQclear(res);
@@ -122,9 +976,7 @@ DbResult Database::activateCard(const std::string& card_id, int phone) noexcept
     std::string phoneStr = std::to_string(phone);
     const char* updateParams[2] = { phoneStr.c_str(), card_id.c_str() };
     
-    res = PQexecParams(pg,
-        "UPDATE opencard SET status = 'A', phone = $1, total_to_pay = 0 WHERE card_id = $2",
-        2, nullptr, updateParams, nullptr, nullptr, 0);
+    res = execStmt(pg, Stmt::CardActivate, updateParams);
     
     if (PQresultStatus(res) != PGRES_COMMAND_OK) {
         PQclear(res);
@@ -136,312 +988,1267 @@ DbResult Database::activateCard(const std::string& card_id, int phone) noexcept
 }
 
 DbResult Database::closeCard(const std::string& card_id) noexcept {
-    if (!isAlive()) return DbResult::ConnectionError;
+    CheckoutDTO ignored;
+    return closeCard(card_id, ignored);
+}
 
-    PGconn* pg = static_cast<PGconn*>(conn_);
-    const char* checkParams[1] = { card_id.c_str() };
-    
-    PGresult* checkRes = PQexecParams(pg,
-        "SELECT status FROM opencard WHERE card_id = $1",
-        1, nullptr, checkParams, nullptr, nullptr, 0);
+DbResult Database::closeCard(const std::string& card_id, CheckoutDTO& out) noexcept {
+    Lease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
 
-    if (PQresultStatus(checkRes) != PGRES_TUPLES_OK) {
-        PQclear(checkRes);
-        return DbResult::UnknownError;
-    }
+    PGconn* pg = lease.get();
+    const char* card_param[1] = { card_id.c_str() };
+    CheckoutScope inFlight(totals_.get());
 
-    if (PQntuples(checkRes) == 0) {
-        PQclear(checkRes);
-        return DbResult::NotFound;
-    }
+    // Single round trip; the statement is its own transaction
+    PGresult* res = execStmt(pg, Stmt::CardCheckout, card_param);
+    DbResult result = checkoutResult(res, card_id, out);
+    PQclear(res);
 
-    std::string currentStatus = PQgetvalue(checkRes, 0, 0);
-    PQclear(checkRes);
+    if (result == DbResult::Ok) foldCheckout(out);
 
-    if (currentStatus == "D") return DbResult::InvalidState;
+    return result;
+}
 
-    // Begin atomic transaction for checkout
-    PGresult* beginRes = PQexec(pg, "BEGIN");
-    if (PQresultStatus(beginRes) != PGRES_COMMAND_OK) {
-        PQclear(beginRes);
-        return DbResult::TxError;
-    }
-    PQclear(beginRes);
+DbResult Database::registerConsumption(const std::string& card_id, int32_t productId, int32_t employeeId, int32_t quantidade) noexcept {
+    // Snapshot before leasing: a catalogue reload needs a connection too
+    auto cat = catalogSnapshot();
+    ConsumptionArgs args(cat.get(), card_id, productId, employeeId, quantidade);
 
-    const char* card_param[1] = { card_id.c_str() };
-    
-    // Move temporary consumption data to permanent history
-    PGresult* aggRes = PQexecParams(pg,
-        "INSERT INTO producttotals (product_id, employee_id, qty_total, line_total) "
-        "SELECT product_id, employee_id, SUM(qty), SUM(line_total) "
-        "FROM openconsumption "
-        "WHERE card_id = $1 "
-        "GROUP BY product_id, employee_id "
-        "ON CONFLICT (product_id, employee_id) "
-        "DO UPDATE SET "
-        "qty_total = producttotals.qty_total + EXCLUDED.qty_total, "
-        "line_total = producttotals.line_total + EXCLUDED.line_total",
-        1, nullptr, card_param, nullptr, nullptr, 0);
-
-    if (PQresultStatus(aggRes) != PGRES_COMMAND_OK) {
-        PQclear(aggRes);
-        PQexec(pg, "ROLLBACK");
-        return DbResult::UnknownError;
-    }
-    PQclear(aggRes);
-    
-    // Clear temporary data
-    PGresult* delRes = PQexecParams(pg,
-        "DELETE FROM openconsumption WHERE card_id = $1",
-        1, nullptr, card_param, nullptr, nullptr, 0);
-    
-    if (PQresultStatus(delRes) != PGRES_COMMAND_OK) {
-        PQclear(delRes);
-        PQexec(pg, "ROLLBACK");
-        return DbResult::UnknownError;
-    }
-    PQclear(delRes);
+    Lease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
 
-    // Reset card status
-    PGresult* updateRes = PQexecParams(pg,
-        "UPDATE opencard SET status = 'D', phone = 0, total_to_pay = 0 WHERE card_id = $1",
-        1, nullptr, card_param, nullptr, nullptr, 0);
-    
-    if (PQresultStatus(updateRes) != PGRES_COMMAND_OK) {
-        PQclear(updateRes);
-        PQexec(pg, "ROLLBACK");
-        return DbResult::UnknownError;
-    }
-    PQclear(updateRes);
+    PGconn* pg = lease.get();
 
-    // Commit transaction
-    PGresult* commitRes = PQexec(pg, "COMMIT");
-    if (PQresultStatus(commitRes) != PGRES_COMMAND_OK) {
-        PQclear(commitRes);
-        return DbResult::TxError;
-    }
-    PQclear(commitRes);
+    // One round trip: only active cards consume, total grows by this line only
+    PGresult* res = execStmt(pg, args.id, args.bind());
+    DbResult result = consumptionResult(res);
+    PQclear(res);
 
-    return DbResult::Ok;
+    return result;
 }
 
-DbResult Database::registerConsumption(const std::string& card_id, int32_t productId, int32_t employeeId, int32_t quantidade) noexcept {
-    if (!isAlive()) return DbResult::ConnectionError;
+DbResult Database::registerCart(const std::string& card_id, int32_t employeeId,
+                                const std::vector<CartLineDTO>& lines, double& newTotal) noexcept {
+    if (lines.empty()) return DbResult::ConstraintFailed;
 
-    PGconn* pg = static_cast<PGconn*>(conn_);
-    const char* checkParams[1] = { card_id.c_str() };
-    
-    PGresult* checkRes = PQexecParams(pg,
-        "SELECT status FROM opencard WHERE card_id = $1",
-        1, nullptr, checkParams, nullptr, nullptr, 0);
+    std::vector<std::string> productIds, qtys;
+    productIds.reserve(lines.size());
+    qtys.reserve(lines.size());
+    for (const auto& line : lines) {
+        productIds.push_back(std::to_string(line.product_id));
+        qtys.push_back(std::to_string(line.qty));
+    }
+    std::string employee = std::to_string(employeeId);
+    std::string productArray = toTextArray(productIds);
+    std::string qtyArray = toTextArray(qtys);
+    const char* params[4] = { card_id.c_str(), employee.c_str(), productArray.c_str(), qtyArray.c_str() };
+
+    Lease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    // One statement, so one round trip and one commit for the whole cart
+    PGresult* res = execStmt(lease.get(), Stmt::CartApply, params);
+    DbResult result = consumptionResult(res);
+    if (result == DbResult::Ok) newTotal = pgdecode::asDouble(res, 0, 2);
+    PQclear(res);
 
-    if (PQresultStatus(checkRes) != PGRES_TUPLES_OK) {
-        PQclear(checkRes);
-        return DbResult::UnknownError;
+    return result;
+}
+
+// Sends every item back-to-back in libpq pipeline mode and collects the
+// replies after a single sync, so a burst costs about one round trip.
+// results[i] holds the outcome of items[i]; the call returns Ok only when
+// every item succeeded.
+DbResult Database::registerConsumptions(const std::vector<ConsumptionItemDTO>& items,
+                                        std::vector<DbResult>& results) noexcept {
+    results.assign(items.size(), DbResult::UnknownError);
+    if (items.empty()) return DbResult::Ok;
+
+    auto cat = catalogSnapshot();
+    std::vector<ConsumptionArgs> args;
+    args.reserve(items.size());
+    for (const auto& item : items) {
+        args.emplace_back(cat.get(), item.card_id, item.product_id, item.employee_id, item.qty);
     }
 
-    if (PQntuples(checkRes) == 0) {
-        PQclear(checkRes);
-        return DbResult::NotFound;
+    Lease lease(*this);
+    if (!lease) {
+        results.assign(items.size(), DbResult::ConnectionError);
+        return DbResult::ConnectionError;
     }
 
-    std::string status = PQgetvalue(checkRes, 0, 0);
-    PQclear(checkRes);
+    PGconn* pg = lease.get();
+
+#ifdef LIBPQ_HAS_PIPELINING
+    if (PQenterPipelineMode(pg) != 1) {
+        results.assign(items.size(), DbResult::ConnectionError);
+        return DbResult::ConnectionError;
+    }
 
-    // Only active cards can consume
-    if (status != "A") return DbResult::InvalidState;
+    auto start = std::chrono::steady_clock::now();
+    bool sent = true;
+    for (size_t i = 0; i < items.size() && sent; ++i) {
+        const StatementDef& def = kStatements[static_cast<size_t>(args[i].id)];
+        sent = PQsendQueryPrepared(pg, def.name, def.nParams, args[i].bind(), nullptr, nullptr, 0) == 1;
+    }
+    sent = sent && PQpipelineSync(pg) == 1;
+
+    if (!sent) {
+        // Connection broke mid-send; libpq discards the pipeline with it
+        PQexitPipelineMode(pg);
+        statsOf(Batch::ConsumptionPipeline).record(elapsedUs(start), 1, 0, QueryError::Connection);
+        results.assign(items.size(), DbResult::ConnectionError);
+        return DbResult::ConnectionError;
+    }
 
-    std::string prodIdStr = std::to_string(productId);
-    std::string empIdStr = std::to_string(employeeId);
-    std::string qtyStr = std::to_string(quantidade);
+    // The pipeline runs as one implicit transaction up to the sync: a hard
+    // error rolls back earlier items and aborts the ones after it
+    bool hardError = false;
+    QueryError error = QueryError::None;
+    for (size_t i = 0; i < items.size(); ++i) {
+        PGresult* res = PQgetResult(pg);
+        if (res == nullptr) {
+            results[i] = DbResult::ConnectionError;
+            error = QueryError::Connection;
+            continue;
+        }
 
-    const char* insertParams[4] = {
-        card_id.c_str(),
-        prodIdStr.c_str(),
-        empIdStr.c_str(),
-        qtyStr.c_str()
-    };
+        ExecStatusType st = PQresultStatus(res);
+        if (st == PGRES_PIPELINE_ABORTED) {
+            results[i] = DbResult::TxError;
+        } else if (st == PGRES_FATAL_ERROR) {
+            results[i] = DbResult::UnknownError;
+            hardError = true;
+            if (error == QueryError::None) error = classifyResult(pg, res);
+        } else {
+            results[i] = consumptionResult(res);
+        }
+        PQclear(res);
 
-    PGresult* insertRes = PQexecParams(pg,
-        "INSERT INTO openconsumption (card_id, product_id, employee_id, qty, price_unit) "
-        "SELECT $1, $2, $3, $4, price_unit "
-        "FROM product WHERE product_id = $2",
-        4, nullptr, insertParams, nullptr, nullptr, 0);
+        // Each query's results end with a NULL separator
+        while ((res = PQgetResult(pg)) != nullptr) PQclear(res);
+    }
 
-    if (PQresultStatus(insertRes) != PGRES_COMMAND_OK) {
-        PQclear(insertRes);
-        return DbResult::UnknownError;
+    // Drain up to and including the sync marker
+    for (PGresult* res = PQgetResult(pg); res != nullptr; res = PQgetResult(pg)) {
+        bool isSync = PQresultStatus(res) == PGRES_PIPELINE_SYNC;
+        PQclear(res);
+        if (isSync) break;
     }
-    PQclear(insertRes);
+    PQexitPipelineMode(pg);
+    statsOf(Batch::ConsumptionPipeline).record(elapsedUs(start), 1, items.size(), error);
 
-    // Update running total on the card
-    PGresult* updateRes = PQexecParams(pg,
-        "UPDATE opencard SET total_to_pay = ("
-        "  SELECT COALESCE(SUM(line_total), 0) "
-        "  FROM openconsumption WHERE card_id = $1"
-        ") WHERE card_id = $1",
-        1, nullptr, checkParams, nullptr, nullptr, 0);
+    if (hardError) {
+        for (DbResult& r : results) {
+            if (r == DbResult::Ok) r = DbResult::TxError;
+        }
+    }
+#else
+    // libpq < 14: same statement, one round trip per item
+    for (size_t i = 0; i < items.size(); ++i) {
+        PGresult* res = execStmt(pg, args[i].id, args[i].bind());
+        results[i] = consumptionResult(res);
+        PQclear(res);
+    }
+#endif
 
-    if (PQresultStatus(updateRes) != PGRES_COMMAND_OK) {
-        PQclear(updateRes);
-        return DbResult::UnknownError;
+    for (DbResult r : results) {
+        if (r != DbResult::Ok) return r;
     }
-    PQclear(updateRes);
-    
     return DbResult::Ok;
 }
 
-/* Data Retrieval & Reporting */
+/* Journal Replay */
+
+// Encoded parameters for one journal record; a consumption reuses the
+// consumption_apply_priced statement with the price the sale was taken at
+struct JournalArgs {
+    Stmt id;
+    std::string phone;
+    ConsumptionArgs consumption;
+    const char* params[2] = {};
+    CheckoutDTO checkout;
+
+    explicit JournalArgs(const JournalRecordDTO& rec)
+        : id(Stmt::CardCheckout),
+          consumption(rec.price_unit, rec.card_id, rec.product_id, rec.employee_id, rec.qty) {
+        if (rec.kind == 'A') {
+            id = Stmt::JournalActivate;
+            phone = std::to_string(rec.phone);
+        } else if (rec.kind == 'C') {
+            id = Stmt::ConsumptionApplyPriced;
+        }
+    }
 
-DbResult Database::getCardSummary(const std::string& card_id, CardSummaryDTO& out) noexcept {
-    if (!isAlive()) return DbResult::ConnectionError;
-    
-    PGconn* pg = static_cast<PGconn*>(conn_);
-    const char* cardParams[1] = { card_id.c_str() };
-    
-    bool useEmployeeView;
-    {
-        // Thread-safe access to configuration
-        std::lock_guard<std::mutex> lock(modeMutex_);
-        useEmployeeView = employeeViewMode_;
+    const char* const* bind() {
+        if (id == Stmt::ConsumptionApplyPriced) return consumption.bind();
+        if (id == Stmt::JournalActivate) {
+            params[0] = phone.c_str();
+            params[1] = consumption.cardId.c_str();
+        } else {
+            params[0] = consumption.cardId.c_str();
+        }
+        return params;
     }
-    
-    PGresult* cardRes = PQexecParams(pg,
-        "SELECT card_id, phone, status, total_to_pay FROM opencard WHERE card_id = $1",
-        1, nullptr, cardParams, nullptr, nullptr, 0);
 
-    if (PQresultStatus(cardRes) != PGRES_TUPLES_OK) {
-        PQclear(cardRes);
-        return DbResult::UnknownError;
+    DbResult result(const PGresult* res) {
+        if (id == Stmt::ConsumptionApplyPriced) return consumptionResult(res);
+        if (id == Stmt::JournalActivate) return journalActivateResult(res);
+        return checkoutResult(res, consumption.cardId, checkout);
     }
+};
 
-    if (PQntuples(cardRes) == 0) {
-        PQclear(cardRes);
-        return DbResult::NotFound;
+// A statement that failed on a live connection is a real SQL error; one
+// that failed because the link dropped must be retried, not skipped
+static DbResult failureOn(PGconn* pg) noexcept {
+    return PQstatus(pg) == CONNECTION_OK ? DbResult::TxError : DbResult::ConnectionError;
+}
+
+static void rollback(PGconn* pg) noexcept {
+    PGresult* res = execTimed(pg, Batch::Transaction, "ROLLBACK");
+    PQclear(res);
+}
+
+// Two round trips per batch: BEGIN plus the cursor lock, then every pending
+// record, the cursor advance and COMMIT (pipelined when libpq allows).
+// Either the whole batch and its cursor commit, or nothing does.
+DbResult Database::applyJournal(const std::string& source, const std::vector<JournalRecordDTO>& records,
+                                std::vector<DbResult>& results, uint64_t& skipped) noexcept {
+    results.assign(records.size(), DbResult::ConnectionError);
+    skipped = 0;
+    if (records.empty()) return DbResult::Ok;
+
+    Lease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    PGconn* pg = lease.get();
+    const char* sourceParam[1] = { source.c_str() };
+
+    PGresult* res = execTimed(pg, Batch::Transaction, "BEGIN");
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    PQclear(res);
+    if (!ok) return failureOn(pg);
+
+    res = execStmt(pg, Stmt::JournalCursorLock, sourceParam);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1) {
+        PQclear(res);
+        DbResult r = failureOn(pg);
+        rollback(pg);
+        return r;
     }
+    uint64_t cursor = static_cast<uint64_t>(pgdecode::asInt(res, 0, 0));
+    PQclear(res);
 
-    if (PQnfields(cardRes) < 4) {
-        PQclear(cardRes);
-        return DbResult::UnknownError;
+    // Records up to the cursor committed before; a lost COMMIT reply lands here
+    std::vector<size_t> todo;
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (records[i].seq <= cursor) {
+            results[i] = DbResult::Ok;
+            skipped++;
+        } else {
+            todo.push_back(i);
+        }
     }
 
-    out.card_id = PQgetvalue(cardRes, 0, 0);
-    
-    const char* phoneVal = PQgetvalue(cardRes, 0, 1);
-    // Hide phone number based on privacy setting
-    out.phone = (phoneVal && strlen(phoneVal) > 0) ? (useEmployeeView ? 0 : std::stoi(phoneVal)) : 0;
-    
-    const char* statusVal = PQgetvalue(cardRes, 0, 2);
-    out.status = (statusVal && strlen(statusVal) > 0) ? statusVal[0] : '?';
-    
-    const char* totalVal = PQgetvalue(cardRes, 0, 3);
-    out.total_to_pay = (totalVal && strlen(totalVal) > 0) ? std::stod(totalVal) : 0.0;
-    
-    PQclear(cardRes);
+    std::vector<JournalArgs> args;
+    args.reserve(todo.size());
+    bool hasCheckout = false;
+    for (size_t i : todo) {
+        args.emplace_back(records[i]);
+        hasCheckout = hasCheckout || args.back().id == Stmt::CardCheckout;
+    }
+    CheckoutScope inFlight(hasCheckout ? totals_.get() : nullptr);
 
-    PGresult* consRes = PQexecParams(pg,
-        "SELECT c.id_consumption, c.card_id, c.product_id, c.employee_id, c.qty, "
-        "c.price_unit, c.line_total, p.product_name "
-        "FROM openconsumption c "
-        "JOIN product p ON p.product_id = c.product_id "
-        "WHERE c.card_id = $1",
-        1, nullptr, cardParams, nullptr, nullptr, 0);
+    std::string lastSeq = std::to_string(records.back().seq);
+    const char* advanceParams[2] = { source.c_str(), lastSeq.c_str() };
 
-    if (PQresultStatus(consRes) != PGRES_TUPLES_OK) {
-        PQclear(consRes);
-        return DbResult::UnknownError;
+#ifdef LIBPQ_HAS_PIPELINING
+    if (PQenterPipelineMode(pg) != 1) {
+        rollback(pg);
+        return DbResult::ConnectionError;
     }
 
-    int nRows = PQntuples(consRes);
-    out.lines.clear();
-    out.lines.reserve(nRows);
+    // Records, cursor advance and COMMIT in one round trip
+    auto start = std::chrono::steady_clock::now();
+    const StatementDef& advance = kStatements[static_cast<size_t>(Stmt::JournalCursorAdvance)];
+    bool sent = true;
+    for (size_t k = 0; k < args.size() && sent; ++k) {
+        const StatementDef& def = kStatements[static_cast<size_t>(args[k].id)];
+        sent = PQsendQueryPrepared(pg, def.name, def.nParams, args[k].bind(), nullptr, nullptr, 0) == 1;
+    }
+    sent = sent && PQsendQueryPrepared(pg, advance.name, advance.nParams, advanceParams, nullptr, nullptr, 0) == 1;
+    sent = sent && PQsendQueryParams(pg, "COMMIT", 0, nullptr, nullptr, nullptr, nullptr, 0) == 1;
+    sent = sent && PQpipelineSync(pg) == 1;
+
+    if (!sent) {
+        PQexitPipelineMode(pg);
+        statsOf(Batch::JournalPipeline).record(elapsedUs(start), 1, 0, QueryError::Connection);
+        return DbResult::ConnectionError;
+    }
 
-    for (int i = 0; i < nRows; ++i) {
-        ConsumptionLineDTO line;
-        
-        const char* idVal = PQgetvalue(consRes, i, 0);
-        line.id_consumption = (idVal && strlen(idVal) > 0) ? std::stoull(idVal) : 0;
-        
-        line.card_id = PQgetvalue(consRes, i, 1);
-        line.product_id = std::stoi(PQgetvalue(consRes, i, 2));
-        line.employee_id = std::stoi(PQgetvalue(consRes, i, 3));
-        line.qty = std::stoi(PQgetvalue(consRes, i, 4));
-        line.price_unit = std::stod(PQgetvalue(consRes, i, 5));
-        line.line_total = std::stod(PQgetvalue(consRes, i, 6));
-        line.product_name = PQgetvalue(consRes, i, 7);
+    // Records, cursor advance, COMMIT, each followed by its NULL separator
+    bool failed = false;
+    QueryError error = QueryError::None;
+    size_t replies = args.size() + 2;
+    for (size_t k = 0; k < replies; ++k) {
+        res = PQgetResult(pg);
+        if (res == nullptr) {
+            failed = true;
+            error = QueryError::Connection;
+            continue;
+        }
 
-        out.lines.push_back(std::move(line));
+        ExecStatusType st = PQresultStatus(res);
+        if (st == PGRES_FATAL_ERROR || st == PGRES_PIPELINE_ABORTED) {
+            failed = true;
+            if (st == PGRES_FATAL_ERROR && error == QueryError::None) error = classifyResult(pg, res);
+        } else if (k < args.size()) {
+            results[todo[k]] = args[k].result(res);
+        }
+        PQclear(res);
+
+        while ((res = PQgetResult(pg)) != nullptr) PQclear(res);
     }
 
-    PQclear(consRes);
+    for (res = PQgetResult(pg); res != nullptr; res = PQgetResult(pg)) {
+        bool isSync = PQresultStatus(res) == PGRES_PIPELINE_SYNC;
+        PQclear(res);
+        if (isSync) break;
+    }
+    PQexitPipelineMode(pg);
+    statsOf(Batch::JournalPipeline).record(elapsedUs(start), 1, args.size(), error);
+#else
+    bool failed = false;
+    for (size_t k = 0; k < args.size() && !failed; ++k) {
+        res = execStmt(pg, args[k].id, args[k].bind());
+        if (PQresultStatus(res) == PGRES_FATAL_ERROR) failed = true;
+        else results[todo[k]] = args[k].result(res);
+        PQclear(res);
+    }
+    if (!failed) {
+        res = execStmt(pg, Stmt::JournalCursorAdvance, advanceParams);
+        failed = PQresultStatus(res) != PGRES_COMMAND_OK;
+        PQclear(res);
+    }
+    if (!failed) {
+        res = execTimed(pg, Batch::Transaction, "COMMIT");
+        failed = PQresultStatus(res) != PGRES_COMMAND_OK;
+        PQclear(res);
+    }
+#endif
+
+    if (failed) {
+        DbResult r = failureOn(pg);
+        if (r != DbResult::ConnectionError) rollback(pg);
+        results.assign(records.size(), r);
+        skipped = 0;
+        return r;
+    }
+
+    // Committed: only now do the checkouts count towards the totals
+    for (size_t k = 0; k < args.size(); ++k) {
+        if (args[k].id == Stmt::CardCheckout && results[todo[k]] == DbResult::Ok) foldCheckout(args[k].checkout);
+    }
     return DbResult::Ok;
 }
 
-DbResult Database::getTotals(std::vector<TotalsRowDTO>& out) noexcept {
-    if (!isAlive()) return DbResult::ConnectionError;
+DbResult Database::journalCursor(const std::string& source, uint64_t& lastSeq) noexcept {
+    Lease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    const char* params[1] = { source.c_str() };
+    PGresult* res = execStmt(lease.get(), Stmt::JournalCursorGet, params);
+
+    DbResult result = DbResult::Ok;
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        result = DbResult::UnknownError;
+    } else {
+        lastSeq = PQntuples(res) == 0 ? 0 : static_cast<uint64_t>(pgdecode::asInt(res, 0, 0));
+    }
+    PQclear(res);
+
+    return result;
+}
+
+/* Bulk Transfer */
+
+// COPY cannot be prepared, so these run through PQexec. Binary format
+// skips text parsing on both ends; exports cast every column to a fixed
+// wire type so the decoder does not depend on the schema's exact types.
+
+static const char kCopySignature[11] = { 'P', 'G', 'C', 'O', 'P', 'Y', '\n', '\377', '\r', '\n', '\0' };
+static const size_t kCopyChunk = 64 * 1024;
+
+static void putBe16(std::string& buf, uint16_t v) {
+    buf += static_cast<char>(v >> 8);
+    buf += static_cast<char>(v & 0xFF);
+}
+
+static void putBe32(std::string& buf, uint32_t v) {
+    putBe16(buf, static_cast<uint16_t>(v >> 16));
+    putBe16(buf, static_cast<uint16_t>(v & 0xFFFF));
+}
+
+// Walks the fields of one binary COPY tuple. libpq hands COPY OUT data
+// over one tuple per PQgetCopyData call; the first also carries the header.
+class CopyTupleReader {
+private:
+    const char* p_;
+    const char* end_;
+
+public:
+    CopyTupleReader(const char* data, int len, bool first) : p_(data), end_(data + len) {
+        if (first && len >= 19 && memcmp(data, kCopySignature, sizeof(kCopySignature)) == 0) {
+            uint32_t extLen = pgdecode::be32(data + 15);
+            p_ += 19 + extLen;
+        }
+    }
+
+    // Field count, or -1 for the trailer
+    int fieldCount() {
+        if (end_ - p_ < 2) return -1;
+        int n = static_cast<int16_t>(pgdecode::be16(p_));
+        p_ += 2;
+        return n;
+    }
+
+    // data is null for SQL NULL; false when the tuple is truncated
+    bool field(const char*& data, int32_t& len) {
+        if (end_ - p_ < 4) return false;
+        len = static_cast<int32_t>(pgdecode::be32(p_));
+        p_ += 4;
+        if (len < 0) {
+            data = nullptr;
+            return true;
+        }
+        if (end_ - p_ < len) return false;
+        data = p_;
+        p_ += len;
+        return true;
+    }
+
+    int64_t int8() {
+        const char* d; int32_t len;
+        return field(d, len) && d && len == 8 ? static_cast<int64_t>(pgdecode::be64(d)) : 0;
+    }
+
+    int32_t int4() {
+        const char* d; int32_t len;
+        return field(d, len) && d && len == 4 ? static_cast<int32_t>(pgdecode::be32(d)) : 0;
+    }
+
+    double float8() {
+        const char* d; int32_t len;
+        if (!field(d, len) || !d || len != 8) return 0.0;
+        uint64_t bits = pgdecode::be64(d);
+        double v;
+        memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+
+    void text(std::string& out) {
+        const char* d; int32_t len;
+        if (field(d, len) && d) out.assign(d, static_cast<size_t>(len));
+        else out.clear();
+    }
+};
+
+static bool execCommand(PGconn* pg, const char* sql) noexcept {
+    PGresult* res = PQexec(pg, sql);
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    PQclear(res);
+    return ok;
+}
+
+static bool execCommand(PGconn* pg, Batch id, const char* sql) noexcept {
+    PGresult* res = execTimed(pg, id, sql);
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    PQclear(res);
+    return ok;
+}
+
+// Runs a COPY ... TO STDOUT (FORMAT binary) and hands every tuple to decode
+static DbResult copyOut(PGconn* pg, const char* sql, int nFields,
+                        const std::function<bool(CopyTupleReader&)>& decode) noexcept {
+    auto start = std::chrono::steady_clock::now();
+    PGresult* res = PQexec(pg, sql);
+    bool started = PQresultStatus(res) == PGRES_COPY_OUT;
+    QueryError error = classifyResult(pg, res);
+    PQclear(res);
+    if (!started) {
+        statsOf(Batch::CopyOut).record(elapsedUs(start), 1, 0, error);
+        return failureOn(pg);
+    }
+    uint64_t tuples = 0;
+
+    bool first = true;
+    bool wanted = true;
+    bool malformed = false;
+    char* buf = nullptr;
+    int n;
+
+    // Keep draining after the sink stops: the stream must end before the
+    // connection can be reused
+    while ((n = PQgetCopyData(pg, &buf, 0)) > 0) {
+        CopyTupleReader tuple(buf, n, first);
+        first = false;
+
+        int fields = tuple.fieldCount();
+        if (fields == nFields) tuples++;
+        if (fields == nFields && wanted) {
+            try {
+                wanted = decode(tuple);
+            } catch (...) {
+                wanted = false;
+            }
+        } else if (fields != -1 && fields != nFields) {
+            malformed = true;
+        }
+        PQfreemem(buf);
+    }
+
+    DbResult result = DbResult::Ok;
+    if (n == -2) {
+        result = DbResult::ConnectionError;
+        error = QueryError::Connection;
+    }
+    while ((res = PQgetResult(pg)) != nullptr) {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK && result == DbResult::Ok) {
+            result = failureOn(pg);
+            error = classifyResult(pg, res);
+        }
+        PQclear(res);
+    }
+    if (result == DbResult::Ok && malformed) {
+        result = DbResult::UnknownError;
+        error = QueryError::Other;
+    }
+    statsOf(Batch::CopyOut).record(elapsedUs(start), 1, tuples, error);
+    return result;
+}
+
+DbResult Database::importCards(const std::function<bool(std::string&)>& next,
+                               uint64_t& inserted, uint64_t& skipped) noexcept {
+    inserted = skipped = 0;
+
+    Lease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    PGconn* pg = lease.get();
+
+    if (!execCommand(pg, Batch::Transaction, "BEGIN")) return failureOn(pg);
+
+    auto abort = [pg]() {
+        DbResult r = failureOn(pg);
+        if (r != DbResult::ConnectionError) rollback(pg);
+        return r;
+    };
+
+    // The temp table, the COPY and its data stream are timed as one copy_in
+    auto copyStart = std::chrono::steady_clock::now();
+    auto copyFailed = [&]() {
+        statsOf(Batch::CopyIn).record(elapsedUs(copyStart), 2, 0,
+            PQstatus(pg) == CONNECTION_OK ? QueryError::Other : QueryError::Connection);
+        return abort();
+    };
+
+    if (!execCommand(pg, "CREATE TEMP TABLE cardimport (card_id text) ON COMMIT DROP")) return copyFailed();
 
-    PGconn* pg = static_cast<PGconn*>(conn_);
+    PGresult* res = PQexec(pg, "COPY cardimport (card_id) FROM STDIN (FORMAT binary)");
+    bool started = PQresultStatus(res) == PGRES_COPY_IN;
+    PQclear(res);
+    if (!started) return copyFailed();
+
+    // Header: signature, flags, header extension length
+    std::string buf(kCopySignature, sizeof(kCopySignature));
+    putBe32(buf, 0);
+    putBe32(buf, 0);
+
+    uint64_t copied = 0;
+    bool sent = true;
+    const char* failure = nullptr;
+    try {
+        std::string id;
+        while (sent && next(id)) {
+            if (id.empty()) continue;
+            putBe16(buf, 1);
+            putBe32(buf, static_cast<uint32_t>(id.size()));
+            buf += id;
+            copied++;
+
+            if (buf.size() >= kCopyChunk) {
+                sent = PQputCopyData(pg, buf.data(), static_cast<int>(buf.size())) == 1;
+                buf.clear();
+            }
+        }
+    } catch (...) {
+        failure = "card source failed";
+    }
+
+    putBe16(buf, 0xFFFF);
+    sent = sent && PQputCopyData(pg, buf.data(), static_cast<int>(buf.size())) == 1;
+    if (!sent) failure = "send failed";
+    if (PQputCopyEnd(pg, failure) != 1) {
+        statsOf(Batch::CopyIn).record(elapsedUs(copyStart), 2, 0, QueryError::Connection);
+        return DbResult::ConnectionError;
+    }
+
+    bool copiedOk = true;
+    while ((res = PQgetResult(pg)) != nullptr) {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) copiedOk = false;
+        PQclear(res);
+    }
+    if (!copiedOk || failure != nullptr) return copyFailed();
+    statsOf(Batch::CopyIn).record(elapsedUs(copyStart), 2, copied, QueryError::None);
+
+    res = execTimed(pg, Batch::CardImportMerge,
+        "INSERT INTO opencard (card_id, status, phone, total_to_pay) "
+        "SELECT DISTINCT card_id, 'D', 0, 0 FROM cardimport "
+        "ON CONFLICT (card_id) DO NOTHING");
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    uint64_t added = ok ? std::strtoull(PQcmdTuples(res), nullptr, 10) : 0;
+    PQclear(res);
+    if (!ok) return abort();
+
+    if (!execCommand(pg, Batch::Transaction, "COMMIT")) return abort();
+
+    inserted = added;
+    skipped = copied - added;
+    return DbResult::Ok;
+}
+
+DbResult Database::exportConsumptions(const std::function<bool(const ConsumptionLineDTO&)>& sink) noexcept {
+    ReadLease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    ConsumptionLineDTO line;
+    return copyOut(lease.get(),
+        "COPY (SELECT c.id_consumption::int8, c.card_id::text, c.product_id::int4, "
+        "c.employee_id::int4, c.qty::int4, c.price_unit::float8, c.line_total::float8, "
+        "p.product_name::text "
+        "FROM openconsumption c "
+        "LEFT JOIN product p ON p.product_id = c.product_id "
+        "ORDER BY c.id_consumption) TO STDOUT (FORMAT binary)",
+        8,
+        [&](CopyTupleReader& t) {
+            line.id_consumption = static_cast<uint64_t>(t.int8());
+            t.text(line.card_id);
+            line.product_id = t.int4();
+            line.employee_id = t.int4();
+            line.qty = t.int4();
+            line.price_unit = t.float8();
+            line.line_total = t.float8();
+            t.text(line.product_name);
+            return sink(line);
+        });
+}
 
-    PGresult* res = PQexec(pg,
-        "SELECT t.product_id, p.product_name, t.employee_id, u.username, "
-        "t.qty_total, t.line_total "
+DbResult Database::exportTotals(const std::function<bool(const TotalsRowDTO&)>& sink) noexcept {
+    ReadLease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    TotalsRowDTO row;
+    return copyOut(lease.get(),
+        "COPY (SELECT t.product_id::int4, p.product_name::text, t.employee_id::int4, "
+        "u.username::text, t.qty_total::int8, t.line_total::float8 "
         "FROM producttotals t "
         "JOIN product p ON p.product_id = t.product_id "
         "JOIN users u ON u.user_id = t.employee_id "
-        "ORDER BY t.product_id, t.employee_id");
+        "ORDER BY t.product_id, t.employee_id) TO STDOUT (FORMAT binary)",
+        6,
+        [&](CopyTupleReader& t) {
+            row.product_id = t.int4();
+            t.text(row.product_name);
+            row.employee_id = t.int4();
+            t.text(row.employee_username);
+            row.qty_total = static_cast<uint64_t>(t.int8());
+            row.line_total = t.float8();
+            return sink(row);
+        });
+}
 
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+/* Streaming Reads */
+
+static const int kStreamChunkRows = 256;
+
+// Runs one registry statement in chunked or single-row mode and hands each
+// row to visit as its chunk arrives. A visitor returning false cancels the
+// query; the rest of the reply is drained so the connection can be reused.
+static DbResult streamStmt(PGconn* pg, Stmt id, const char* const* params, int resultFormat,
+                           const std::function<bool(const PGresult*, int)>& visit) noexcept {
+    const StatementDef& def = kStatements[static_cast<size_t>(id)];
+    auto start = std::chrono::steady_clock::now();
+
+    if (PQsendQueryPrepared(pg, def.name, def.nParams, params, nullptr, nullptr, resultFormat) != 1) {
+        statsOf(id).record(elapsedUs(start), 1, 0, QueryError::Connection);
+        return DbResult::ConnectionError;
+    }
+#ifdef LIBPQ_HAS_CHUNK_MODE
+    PQsetChunkedRowsMode(pg, kStreamChunkRows);
+#else
+    PQsetSingleRowMode(pg);
+#endif
+
+    DbResult result = DbResult::Ok;
+    QueryError error = QueryError::None;
+    uint64_t rows = 0;
+    bool wanted = true;
+    bool cancelled = false;
+
+    PGresult* res;
+    while ((res = PQgetResult(pg)) != nullptr) {
+        ExecStatusType st = PQresultStatus(res);
+        bool hasRows = st == PGRES_SINGLE_TUPLE || st == PGRES_TUPLES_OK;
+#ifdef LIBPQ_HAS_CHUNK_MODE
+        hasRows = hasRows || st == PGRES_TUPLES_CHUNK;
+#endif
+        if (hasRows) {
+            int n = PQntuples(res);
+            for (int i = 0; i < n && wanted; ++i) {
+                try {
+                    wanted = visit(res, i);
+                } catch (...) {
+                    wanted = false;
+                }
+                rows++;
+            }
+            if (!wanted && !cancelled) {
+                cancelled = true;
+                if (PGcancel* cancel = PQgetCancel(pg)) {
+                    char err[256];
+                    PQcancel(cancel, err, sizeof(err));
+                    PQfreeCancel(cancel);
+                }
+            }
+        } else if (!cancelled && result == DbResult::Ok) {
+            // A failure after cancelling is the cancel itself
+            error = classifyResult(pg, res);
+            result = PQstatus(pg) == CONNECTION_OK ? DbResult::UnknownError : DbResult::ConnectionError;
+        }
         PQclear(res);
-        return DbResult::UnknownError;
     }
 
-    int nRows = PQntuples(res);
-    out.clear();
-    out.reserve(nRows);
+    statsOf(id).record(elapsedUs(start), 1, rows, error);
+    return result;
+}
 
-    for (int i = 0; i < nRows; ++i) {
-        TotalsRowDTO row;
-        row.product_id = std::stoi(PQgetvalue(res, i, 0));
-        row.product_name = PQgetvalue(res, i, 1);
-        row.employee_id = std::stoi(PQgetvalue(res, i, 2));
-        row.employee_username = PQgetvalue(res, i, 3);
-        row.qty_total = std::stoull(PQgetvalue(res, i, 4));
-        row.line_total = std::stod(PQgetvalue(res, i, 5));
+/* Data Retrieval & Reporting */
+
+DbResult Database::getCardSummary(const std::string& card_id, CardSummaryDTO& out, bool replicaOk) noexcept {
+    auto cat = catalogSnapshot();
+
+    bool useEmployeeView;
+    {
+        // Thread-safe access to configuration
+        std::lock_guard<std::mutex> lock(modeMutex_);
+        useEmployeeView = employeeViewMode_;
+    }
+
+    // Owner views are reports; the employee's checkout flow reads the primary
+    ReadLease lease(*this, replicaOk && !useEmployeeView);
+    if (!lease) return DbResult::ConnectionError;
+
+    PGconn* pg = lease.get();
+    const char* cardParams[1] = { card_id.c_str() };
+    
+    int fmt = binaryResults_.load(std::memory_order_relaxed) ? 1 : 0;
+    PGresult* cardRes = execStmt(pg, Stmt::CardHeader, cardParams, fmt);
+    DbResult result = decodeCardHeader(cardRes, useEmployeeView, out);
+    PQclear(cardRes);
+
+    if (result != DbResult::Ok) return result;
+
+    bool namesMissing = false;
+    PGresult* consRes = execStmt(pg, cat ? Stmt::CardLinesBare : Stmt::CardLines, cardParams, fmt);
+    result = decodeCardLines(consRes, out, cat.get(), &namesMissing);
+    PQclear(consRes);
 
-        out.push_back(std::move(row));
+    if (namesMissing) {
+        // A product newer than the snapshot: join this once, refresh later
+        catalog_->invalidate();
+        consRes = execStmt(pg, Stmt::CardLines, cardParams, fmt);
+        result = decodeCardLines(consRes, out);
+        PQclear(consRes);
     }
 
-    PQclear(res);
+    return result;
+}
+
+// Same queries as above; lines are left in the result instead of copied
+DbResult Database::getCardSummary(const std::string& card_id, CardSummaryView& out) noexcept {
+    out.catalog = catalogSnapshot();
+    out.lines.reset();
+
+    bool useEmployeeView;
+    {
+        std::lock_guard<std::mutex> lock(modeMutex_);
+        useEmployeeView = employeeViewMode_;
+    }
+
+    ReadLease lease(*this, !useEmployeeView);
+    if (!lease) return DbResult::ConnectionError;
+    out.maybe_stale = lease.onReplica();
+
+    PGconn* pg = lease.get();
+    const char* cardParams[1] = { card_id.c_str() };
+
+    int fmt = binaryResults_.load(std::memory_order_relaxed) ? 1 : 0;
+    PGresult* cardRes = execStmt(pg, Stmt::CardHeader, cardParams, fmt);
+    DbResult result = DbResult::UnknownError;
+    if (PQresultStatus(cardRes) == PGRES_TUPLES_OK && PQntuples(cardRes) == 0) {
+        result = DbResult::NotFound;
+    } else if (PQresultStatus(cardRes) == PGRES_TUPLES_OK && PQnfields(cardRes) >= 4) {
+        pgdecode::RowView header(cardRes, 0);
+        out.card_id.assign(header.text(0));
+        out.phone = useEmployeeView ? 0 : static_cast<int>(header.integer(1));
+        out.status = header.character(2);
+        out.total_to_pay = header.real(3);
+        result = DbResult::Ok;
+    }
+    PQclear(cardRes);
+
+    if (result != DbResult::Ok) return result;
+
+    const CatalogSnapshot* cat = out.catalog.get();
+    out.lines = pgdecode::ResultView<CardLineRow>(
+        pgdecode::adopt(execStmt(pg, cat ? Stmt::CardLinesBare : Stmt::CardLines, cardParams, fmt)));
+    if (!out.lines.ok()) return DbResult::UnknownError;
+
+    bool namesMissing = false;
+    if (cat) {
+        for (CardLineRow line : out.lines) {
+            if (cat->find(line.product_id()) == nullptr) {
+                namesMissing = true;
+                break;
+            }
+        }
+    }
+
+    if (namesMissing) {
+        // A product newer than the snapshot: join this once, refresh later
+        catalog_->invalidate();
+        out.catalog.reset();
+        out.lines = pgdecode::ResultView<CardLineRow>(
+            pgdecode::adopt(execStmt(pg, Stmt::CardLines, cardParams, fmt)));
+        if (!out.lines.ok()) return DbResult::UnknownError;
+    }
     return DbResult::Ok;
 }
 
+std::string_view CardSummaryView::productName(const CardLineRow& line) const noexcept {
+    if (!catalog) return line.product_name();
+    const ProductDTO* p = catalog->find(line.product_id());
+    return p ? std::string_view(p->name) : std::string_view();
+}
+
+DbResult Database::getSalesHistory(int windowMinutes, int bucketMinutes, std::vector<SalesBucketDTO>& out) noexcept {
+    if (windowMinutes <= 0 || bucketMinutes <= 0) return DbResult::UnknownError;
+
+    ReadLease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    std::string window = std::to_string(windowMinutes);
+    std::string bucket = std::to_string(bucketMinutes);
+    const char* params[2] = { window.c_str(), bucket.c_str() };
+
+    int fmt = binaryResults_.load(std::memory_order_relaxed) ? 1 : 0;
+    PGresult* res = execStmt(lease.get(), Stmt::SalesHistory, params, fmt);
+    DbResult result = decodeSales(res, out);
+    PQclear(res);
+
+    return result;
+}
+
+DbResult Database::getTotals(std::vector<TotalsRowDTO>& out) noexcept {
+    // Served from memory when the totals cache is on
+    if (totals_) return totals_->get(*this, out);
+
+    ReadLease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    int fmt = binaryResults_.load(std::memory_order_relaxed) ? 1 : 0;
+    PGresult* res = execStmt(lease.get(), Stmt::TotalsReport, nullptr, fmt);
+    DbResult result = decodeTotals(res, out);
+    PQclear(res);
+
+    return result;
+}
+
+DbResult Database::streamTotals(const std::function<bool(const TotalsRowDTO&)>& sink) noexcept {
+    if (totals_) {
+        // Bounded by products x employees; already in memory
+        std::vector<TotalsRowDTO> rows;
+        DbResult r = totals_->get(*this, rows);
+        if (r != DbResult::Ok) return r;
+        for (const TotalsRowDTO& row : rows) {
+            if (!sink(row)) break;
+        }
+        return DbResult::Ok;
+    }
+
+    ReadLease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    TotalsRowDTO row;
+    int fmt = binaryResults_.load(std::memory_order_relaxed) ? 1 : 0;
+    return streamStmt(lease.get(), Stmt::TotalsReport, nullptr, fmt, [&](const PGresult* res, int i) {
+        decodeTotalsRow(res, i, row);
+        return sink(row);
+    });
+}
+
+DbResult Database::streamSalesHistory(int windowMinutes, int bucketMinutes,
+                                      const std::function<bool(const SalesBucketDTO&)>& sink) noexcept {
+    if (windowMinutes <= 0 || bucketMinutes <= 0) return DbResult::UnknownError;
+
+    ReadLease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    std::string window = std::to_string(windowMinutes);
+    std::string bucket = std::to_string(bucketMinutes);
+    const char* params[2] = { window.c_str(), bucket.c_str() };
+
+    SalesBucketDTO row;
+    int fmt = binaryResults_.load(std::memory_order_relaxed) ? 1 : 0;
+    return streamStmt(lease.get(), Stmt::SalesHistory, params, fmt, [&](const PGresult* res, int i) {
+        decodeSalesRow(res, i, row);
+        return sink(row);
+    });
+}
+
+// Seeds the totals cache, which folds primary commits on top: never a replica
+DbResult Database::queryTotals(std::vector<TotalsRowDTO>& out) noexcept {
+    Lease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    PGconn* pg = lease.get();
+
+    int fmt = binaryResults_.load(std::memory_order_relaxed) ? 1 : 0;
+    PGresult* res = execStmt(pg, Stmt::TotalsReport, nullptr, fmt);
+    DbResult result = decodeTotals(res, out);
+    PQclear(res);
+
+    return result;
+}
+
+DbResult Database::loadOpenCards(std::vector<OpenCardDTO>& out) noexcept {
+    Lease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    int fmt = binaryResults_.load(std::memory_order_relaxed) ? 1 : 0;
+    PGresult* res = execStmt(lease.get(), Stmt::OpenCardsAll, nullptr, fmt);
+    DbResult result = decodeOpenCards(res, out);
+    PQclear(res);
+
+    return result;
+}
+
+// Cards absent from the result no longer exist in opencard
+DbResult Database::loadOpenCards(const std::vector<std::string>& card_ids, std::vector<OpenCardDTO>& out) noexcept {
+    out.clear();
+    if (card_ids.empty()) return DbResult::Ok;
+
+    Lease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    std::string ids = toTextArray(card_ids);
+    const char* params[1] = { ids.c_str() };
+
+    int fmt = binaryResults_.load(std::memory_order_relaxed) ? 1 : 0;
+    PGresult* res = execStmt(lease.get(), Stmt::OpenCardsSome, params, fmt);
+    DbResult result = decodeOpenCards(res, out);
+    PQclear(res);
+
+    return result;
+}
+
 DbResult Database::listProducts(std::vector<ProductDTO>& out) noexcept {
-    if (!isAlive()) return DbResult::ConnectionError;
-    
-    PGconn* pg = static_cast<PGconn*>(conn_);
+    // Served from memory when the catalogue cache is on
+    if (auto cat = catalogSnapshot()) {
+        out = cat->products;
+        return DbResult::Ok;
+    }
+
+    ReadLease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    int fmt = binaryResults_.load(std::memory_order_relaxed) ? 1 : 0;
+    PGresult* res = execStmt(lease.get(), Stmt::ProductList, nullptr, fmt);
+    DbResult result = decodeProducts(res, out);
+    PQclear(res);
+
+    return result;
+}
+
+// Catalogue reloads are triggered by primary NOTIFYs: never a replica
+DbResult Database::queryProductList(std::vector<ProductDTO>& out) noexcept {
+    Lease lease(*this);
+    if (!lease) return DbResult::ConnectionError;
+
+    PGconn* pg = lease.get();
     
-    PGresult* res = PQexec(pg,
-        "SELECT product_id, product_name, price_unit FROM product ORDER BY product_name");
+    int fmt = binaryResults_.load(std::memory_order_relaxed) ? 1 : 0;
+    PGresult* res = execStmt(pg, Stmt::ProductList, nullptr, fmt);
+    DbResult result = decodeProducts(res, out);
+    PQclear(res);
 
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-        PQclear(res);
+    return result;
+}
+
+/* Product Catalogue Cache */
+
+void Database::enableCatalogCache() {
+    {
+        std::lock_guard<std::mutex> lock(listenerMtx_);
+        if (catalog_) return;
+        catalog_ = std::make_unique<ProductCatalog>();
+    }
+
+    // Any product row change (or a listener resync) marks the snapshot stale
+    ProductCatalog* cat = catalog_.get();
+    onNotify(NOTIFY_CHANNEL_PRODUCT, [cat](const DbNotification&) { cat->invalidate(); });
+}
+
+std::shared_ptr<const CatalogSnapshot> Database::catalogSnapshot() {
+    if (!catalog_) return nullptr;
+    return catalog_->get(*this);
+}
+
+void Database::invalidateCatalog() {
+    if (catalog_) catalog_->invalidate();
+}
+
+uint64_t Database::catalogVersion() const noexcept {
+    if (!catalog_ || catalog_->isStale()) return 0;
+    return catalog_->version();
+}
+
+uint64_t Database::totalsVersion() const noexcept {
+    if (!totals_ || totals_->isStale()) return 0;
+    return totals_->version();
+}
+
+/* Product Totals Cache */
+
+void Database::enableTotalsCache() {
+    {
+        std::lock_guard<std::mutex> lock(listenerMtx_);
+        if (totals_) return;
+        totals_ = std::make_unique<TotalsCache>();
+    }
+
+    // Renamed products or users, or events missed while the listener was down
+    TotalsCache* totals = totals_.get();
+    onNotify(NOTIFY_CHANNEL_PRODUCT, [totals](const DbNotification&) { totals->invalidate(); });
+    onNotify(NOTIFY_CHANNEL_USER, [totals](const DbNotification&) { totals->invalidate(); });
+    // Our own checkouts are folded in; anyone else's (another terminal, the
+    // back office) can only be picked up by a reseed
+    onNotify(NOTIFY_CHANNEL_TOTALS, [totals](const DbNotification& n) {
+        if (n.resync || n.payload != writerTag()) totals->invalidate();
+    });
+
+    std::vector<TotalsRowDTO> seed;
+    totals_->get(*this, seed);
+}
+
+// May run on the async event loop or with a lease held: only peek at the
+// catalogue, never reload it from here
+void Database::foldCheckout(const CheckoutDTO& checkout) {
+    if (!totals_) return;
+    auto cat = catalog_ ? catalog_->peek() : nullptr;
+    totals_->fold(checkout.folded, cat.get());
+}
+
+/* Invalidation Channel */
+
+void Database::onNotify(const std::string& channel, NotifyHandler handler) {
+    std::lock_guard<std::mutex> lock(listenerMtx_);
+    if (!listener_) listener_ = std::make_unique<NotifyListener>(connString_);
+    listener_->subscribe(channel, std::move(handler));
+}
+
+DbResult Database::startListener() noexcept {
+    try {
+        std::lock_guard<std::mutex> lock(listenerMtx_);
+        if (!listener_) listener_ = std::make_unique<NotifyListener>(connString_);
+        return listener_->start() ? DbResult::Ok : DbResult::UnknownError;
+    } catch (...) {
         return DbResult::UnknownError;
     }
-    
-    int nRows = PQntuples(res);
-    out.clear();
-    out.reserve(nRows);
-    
-    for (int i = 0; i < nRows; ++i) {
-        ProductDTO prod;
-        prod.product_id = std::stoi(PQgetvalue(res, i, 0));
-        prod.name = PQgetvalue(res, i, 1);
-        prod.price_unit = std::stod(PQgetvalue(res, i, 2));
-        out.push_back(std::move(prod));
+}
+
+void Database::stopListener() noexcept {
+    std::lock_guard<std::mutex> lock(listenerMtx_);
+    if (listener_) listener_->stop();
+}
+
+/* Async API */
+
+// Builds an AsyncExecutor job for one registry statement; the job owns its
+// parameter strings and is timed from send to reply
+static AsyncExecutor::Job stmtJob(Stmt id, std::vector<std::string> params, int resultFormat,
+                                  std::function<void(PGresult*)> done) {
+    auto start = std::make_shared<std::chrono::steady_clock::time_point>();
+    return {
+        [id, params = std::move(params), resultFormat, start](PGconn* pg) {
+            const StatementDef& def = kStatements[static_cast<size_t>(id)];
+            std::vector<const char*> values;
+            values.reserve(params.size());
+            for (const auto& p : params) values.push_back(p.c_str());
+            *start = std::chrono::steady_clock::now();
+            return PQsendQueryPrepared(pg, def.name, def.nParams, values.data(), nullptr, nullptr, resultFormat);
+        },
+        [id, start, done = std::move(done)](PGresult* res) {
+            // Never sent: the executor stopped or had no connection
+            if (*start == std::chrono::steady_clock::time_point{}) {
+                statsOf(id).record(0, 0, 0, QueryError::Connection);
+            } else {
+                statsOf(id).record(elapsedUs(*start), 1, resultRows(res), classifyResult(nullptr, res));
+            }
+            done(res);
+        }
+    };
+}
+
+static std::future<DbResult> readyFuture(DbResult r) {
+    std::promise<DbResult> p;
+    p.set_value(r);
+    return p.get_future();
+}
+
+DbResult Database::startAsync(size_t connections) noexcept {
+    try {
+        if (async_ && async_->isRunning()) return DbResult::Ok;
+        async_ = std::make_unique<AsyncExecutor>(connString_, connections, prepareStatements);
+        return async_->start() ? DbResult::Ok : DbResult::ConnectionError;
+    } catch (...) {
+        return DbResult::UnknownError;
     }
+}
 
-    PQclear(res);
-    return DbResult::Ok;
+void Database::stopAsync() noexcept {
+    if (async_) async_->stop();
+}
+
+bool Database::asyncRunning() const noexcept {
+    return async_ && async_->isRunning();
+}
+
+std::future<DbResult> Database::registerConsumptionAsync(const std::string& card_id, int32_t productId,
+                                                         int32_t employeeId, int32_t quantidade) {
+    if (!asyncRunning()) return readyFuture(registerConsumption(card_id, productId, employeeId, quantidade));
+
+    auto cat = catalogSnapshot();
+    ConsumptionArgs args(cat.get(), card_id, productId, employeeId, quantidade);
+
+    auto promise = std::make_shared<std::promise<DbResult>>();
+    auto fut = promise->get_future();
+
+    async_->submit(stmtJob(args.id, args.owned(), 0,
+        [promise](PGresult* res) {
+            promise->set_value(res ? consumptionResult(res) : DbResult::ConnectionError);
+        }));
+    return fut;
+}
+
+std::future<DbResult> Database::closeCardAsync(const std::string& card_id, CheckoutDTO& out) {
+    if (!asyncRunning()) return readyFuture(closeCard(card_id, out));
+
+    auto promise = std::make_shared<std::promise<DbResult>>();
+    auto fut = promise->get_future();
+
+    // done always runs, also when the executor stops first
+    TotalsCache* totals = totals_.get();
+    if (totals) totals->beginCheckout();
+    async_->submit(stmtJob(Stmt::CardCheckout, { card_id }, 0,
+        [this, promise, totals, card_id, &out](PGresult* res) {
+            DbResult r = res ? checkoutResult(res, card_id, out) : DbResult::ConnectionError;
+            if (r == DbResult::Ok) foldCheckout(out);
+            if (totals) totals->endCheckout();
+            promise->set_value(r);
+        }));
+    return fut;
+}
+
+std::future<DbResult> Database::getCardSummaryAsync(const std::string& card_id, CardSummaryDTO& out, bool replicaOk) {
+    if (!asyncRunning()) return readyFuture(getCardSummary(card_id, out, replicaOk));
+
+    bool useEmployeeView;
+    {
+        std::lock_guard<std::mutex> lock(modeMutex_);
+        useEmployeeView = employeeViewMode_;
+    }
+    // The event loop only talks to the primary; replica reads run blocking
+    if (replicaOk && !useEmployeeView && replicaUsable()) return readyFuture(getCardSummary(card_id, out));
+
+    int fmt = binaryResults_.load(std::memory_order_relaxed) ? 1 : 0;
+    auto cat = catalogSnapshot();
+
+    auto promise = std::make_shared<std::promise<DbResult>>();
+    auto fut = promise->get_future();
+    AsyncExecutor* exec = async_.get();
+    ProductCatalog* catalog = catalog_.get();
+
+    // Header first; the lines query is chained from its completion
+    exec->submit(stmtJob(Stmt::CardHeader, { card_id }, fmt,
+        [promise, exec, catalog, cat, card_id, fmt, useEmployeeView, &out](PGresult* res) {
+            DbResult r = res ? decodeCardHeader(res, useEmployeeView, out) : DbResult::ConnectionError;
+            if (r != DbResult::Ok) {
+                promise->set_value(r);
+                return;
+            }
+            exec->submit(stmtJob(cat ? Stmt::CardLinesBare : Stmt::CardLines, { card_id }, fmt,
+                [promise, exec, catalog, cat, card_id, fmt, &out](PGresult* linesRes) {
+                    if (linesRes == nullptr) {
+                        promise->set_value(DbResult::ConnectionError);
+                        return;
+                    }
+
+                    bool namesMissing = false;
+                    DbResult lr = decodeCardLines(linesRes, out, cat.get(), &namesMissing);
+                    if (!namesMissing) {
+                        promise->set_value(lr);
+                        return;
+                    }
+
+                    // Snapshot is missing a product: fetch joined names once
+                    catalog->invalidate();
+                    exec->submit(stmtJob(Stmt::CardLines, { card_id }, fmt,
+                        [promise, &out](PGresult* joinedRes) {
+                            promise->set_value(joinedRes ? decodeCardLines(joinedRes, out) : DbResult::ConnectionError);
+                        }));
+                }));
+        }));
+    return fut;
+}
+
+std::future<DbResult> Database::getTotalsAsync(std::vector<TotalsRowDTO>& out) {
+    if (!asyncRunning() || totals_ || replicaUsable()) return readyFuture(getTotals(out));
+
+    auto promise = std::make_shared<std::promise<DbResult>>();
+    auto fut = promise->get_future();
+    int fmt = binaryResults_.load(std::memory_order_relaxed) ? 1 : 0;
+
+    async_->submit(stmtJob(Stmt::TotalsReport, {}, fmt,
+        [promise, &out](PGresult* res) {
+            promise->set_value(res ? decodeTotals(res, out) : DbResult::ConnectionError);
+        }));
+    return fut;
+}
+
+std::future<DbResult> Database::listProductsAsync(std::vector<ProductDTO>& out) {
+    if (!asyncRunning() || catalog_ || replicaUsable()) return readyFuture(listProducts(out));
+
+    auto promise = std::make_shared<std::promise<DbResult>>();
+    auto fut = promise->get_future();
+    int fmt = binaryResults_.load(std::memory_order_relaxed) ? 1 : 0;
+
+    async_->submit(stmtJob(Stmt::ProductList, {}, fmt,
+        [promise, &out](PGresult* res) {
+            promise->set_value(res ? decodeProducts(res, out) : DbResult::ConnectionError);
+        }));
+    return fut;
 }
 
 /* System Configuration */
@@ -450,3 +2257,102 @@ void Database::setEmployeeViewMode(bool enabled) noexcept {
     std::lock_guard<std::mutex> lock(modeMutex_);
     employeeViewMode_ = enabled;
 }
+
+bool Database::employeeViewMode() const noexcept {
+    std::lock_guard<std::mutex> lock(modeMutex_);
+    return employeeViewMode_;
+}
+
+void Database::setLeaseTimeout(std::chrono::milliseconds timeout) noexcept {
+    std::lock_guard<std::mutex> lock(poolMtx_);
+    leaseTimeout_ = timeout;
+}
+
+// Replica connections get the same prepared statements as the pool
+void Database::setReadReplica(std::string connString, size_t connections, std::chrono::milliseconds maxLag) {
+    replica_ = std::make_unique<ReplicaPool>(std::move(connString), connections, maxLag, prepareStatements);
+}
+
+// Opt-in: summary, totals and product queries fetch binary cells and decode
+// them by column type instead of parsing text
+void Database::setBinaryResults(bool enabled) noexcept {
+    binaryResults_.store(enabled, std::memory_order_relaxed);
+}
+
+/* Diagnostics */
+
+PoolStatsDTO Database::poolStats() const noexcept {
+    std::lock_guard<std::mutex> lock(poolMtx_);
+    PoolStatsDTO s;
+    s.pool_size = pool_.size();
+    s.schema_version = schemaVersion_;
+    s.in_use = pool_.size() - freeSlots_.size();
+    s.peak_in_use = peakInUse_;
+    s.leases = leases_;
+    s.lease_timeouts = leaseTimeouts_;
+    s.total_wait_us = totalWaitUs_;
+    s.max_wait_us = maxWaitUs_;
+    s.lease_unavailable = leaseUnavailable_;
+    s.probe_failures = probeFailures_;
+    s.reconnects = reconnects_;
+    for (const SlotHealth& h : health_) {
+        if (!h.down) s.connections_up++;
+    }
+    std::lock_guard<std::mutex> listenerLock(listenerMtx_);
+    if (catalog_) {
+        s.catalog_version = catalog_->version();
+        s.catalog_reloads = catalog_->reloads();
+    }
+    if (totals_) {
+        s.totals_reloads = totals_->reloads();
+        s.totals_folds = totals_->folds();
+    }
+    if (replica_) {
+        s.replica_configured = true;
+        s.replica_usable = replica_->usable();
+        s.replica_lag_ms = replica_->lagMs();
+        s.replica_reads = replica_->reads();
+        s.replica_fallbacks = replica_->fallbacks();
+        s.replica_reconnects = replica_->reconnects();
+    }
+    if (listener_) {
+        s.listener_running = listener_->isRunning();
+        s.notifications = listener_->received();
+        s.listener_reconnects = listener_->reconnects();
+    }
+    if (async_) {
+        s.async_size = async_->size();
+        s.async_up = async_->healthy();
+        s.async_reconnects = async_->reconnects();
+    }
+
+    if (!pool_.empty()) {
+        auto now = std::chrono::steady_clock::now();
+        uint64_t busy = busyUs_;
+        for (size_t i = 0; i < pool_.size(); ++i) {
+            if (std::find(freeSlots_.begin(), freeSlots_.end(), i) != freeSlots_.end()) continue;
+            busy += std::chrono::duration_cast<std::chrono::microseconds>(now - leasedAt_[i]).count();
+        }
+        uint64_t span = std::chrono::duration_cast<std::chrono::microseconds>(now - poolSince_).count();
+        if (span > 0) s.utilisation = static_cast<double>(busy) / (static_cast<double>(span) * pool_.size());
+    }
+    return s;
+}
+
+std::vector<StatementStatsDTO> Database::statementStats() const {
+    std::vector<StatementStatsDTO> out;
+    for (size_t i = 0; i < static_cast<size_t>(Stmt::Count); ++i) {
+        StatementStatsDTO s = gStmtStats[i].snapshot(kStatements[i].name);
+        if (s.calls > 0) out.push_back(std::move(s));
+    }
+    for (size_t i = 0; i < static_cast<size_t>(Batch::Count); ++i) {
+        StatementStatsDTO s = gBatchStats[i].snapshot(kBatchNames[i]);
+        if (s.calls > 0) out.push_back(std::move(s));
+    }
+    return out;
+}
+
+void Database::resetStatementStats() noexcept {
+    for (StatementStats& s : gStmtStats) s.reset();
+    for (StatementStats& s : gBatchStats) s.reset();
+}
@@ -0,0 +1,65 @@
+/* ==================== EventHub.cpp ==================== */
+
+#include "EventHub.h"
+
+using namespace std;
+
+EventHub::EventHub(size_t capacity) : ring_(capacity > 0 ? capacity : 1) {
+}
+
+/* ==================== Publishing ==================== */
+
+uint64_t EventHub::publish(EventDTO ev) {
+    uint64_t id;
+    {
+        lock_guard<mutex> lock(mtx_);
+        id = ++lastId_;
+        ev.id = id;
+        ring_[id % ring_.size()] = std::move(ev);
+    }
+    cv_.notify_all();
+    return id;
+}
+
+/* ==================== Reading ==================== */
+
+bool EventHub::since(uint64_t& cursor, vector<EventDTO>& out, size_t max) const {
+    lock_guard<mutex> lock(mtx_);
+    if (cursor > lastId_) cursor = 0;
+
+    uint64_t oldest = lastId_ >= ring_.size() ? lastId_ - ring_.size() + 1 : 1;
+    bool complete = cursor + 1 >= oldest;
+    if (!complete) cursor = oldest - 1;
+
+    for (; cursor < lastId_ && max > 0; --max) {
+        ++cursor;
+        out.push_back(ring_[cursor % ring_.size()]);
+    }
+    return complete;
+}
+
+bool EventHub::waitAfter(uint64_t cursor, chrono::milliseconds timeout) const {
+    unique_lock<mutex> lock(mtx_);
+    cv_.wait_for(lock, timeout, [this, cursor] { return closed_ || lastId_ > cursor; });
+    return !closed_ && lastId_ > cursor;
+}
+
+uint64_t EventHub::lastId() const {
+    lock_guard<mutex> lock(mtx_);
+    return lastId_;
+}
+
+/* ==================== Shutdown ==================== */
+
+void EventHub::close() {
+    {
+        lock_guard<mutex> lock(mtx_);
+        closed_ = true;
+    }
+    cv_.notify_all();
+}
+
+bool EventHub::closed() const {
+    lock_guard<mutex> lock(mtx_);
+    return closed_;
+}
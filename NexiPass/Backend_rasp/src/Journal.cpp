@@ -0,0 +1,366 @@
+/* ==================== Journal.cpp ==================== */
+
+#include "Journal.h"
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <ctime>
+#include <random>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+static const char* kHeaderTag = "NXJ1";
+
+// FNV-1a; catches a torn or half-overwritten line, not tampering
+static uint32_t lineChecksum(const char* data, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= static_cast<uint8_t>(data[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static bool writeAll(int fd, const string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static string headerLine(uint64_t appliedSeq, const string& epoch) {
+    return string(kHeaderTag) + " " + to_string(appliedSeq) + (epoch.empty() ? "" : " " + epoch) + "\n";
+}
+
+// Creation time plus random bits: a replaced or re-created file never
+// reuses the cursor of the one before it
+static string newEpoch() {
+    random_device rd;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llx%08x", static_cast<unsigned long long>(time(nullptr)),
+             static_cast<unsigned>(rd()));
+    return buf;
+}
+
+// seq kind card phone product employee qty price checksum, tab separated
+static string encodeRecord(const JournalRecordDTO& rec) {
+    char price[32];
+    snprintf(price, sizeof(price), "%.15g", rec.price_unit);
+
+    string body = to_string(rec.seq) + '\t' + rec.kind + '\t' + rec.card_id + '\t' +
+                  to_string(rec.phone) + '\t' + to_string(rec.product_id) + '\t' +
+                  to_string(rec.employee_id) + '\t' + to_string(rec.qty) + '\t' + price;
+
+    char sum[16];
+    snprintf(sum, sizeof(sum), "\t%08x\n", lineChecksum(body.data(), body.size()));
+    return body + sum;
+}
+
+static bool decodeRecord(const string& line, JournalRecordDTO& rec) {
+    size_t cut = line.rfind('\t');
+    if (cut == string::npos) return false;
+
+    uint32_t expected = 0;
+    if (sscanf(line.c_str() + cut + 1, "%8x", &expected) != 1) return false;
+    if (lineChecksum(line.data(), cut) != expected) return false;
+
+    istringstream in(line.substr(0, cut));
+    string seq, kind, phone, product, employee, qty, price;
+    if (!getline(in, seq, '\t') || !getline(in, kind, '\t') || !getline(in, rec.card_id, '\t') ||
+        !getline(in, phone, '\t') || !getline(in, product, '\t') || !getline(in, employee, '\t') ||
+        !getline(in, qty, '\t') || !getline(in, price, '\t') || kind.size() != 1) {
+        return false;
+    }
+
+    try {
+        rec.seq = stoull(seq);
+        rec.kind = kind[0];
+        rec.phone = stoi(phone);
+        rec.product_id = stoi(product);
+        rec.employee_id = stoi(employee);
+        rec.qty = stoi(qty);
+        rec.price_unit = stod(price);
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
+/* ==================== Lifecycle ==================== */
+
+Journal::Journal(string path, string source)
+    : path_(std::move(path)), source_(std::move(source)) {
+}
+
+Journal::~Journal() {
+    close();
+}
+
+bool Journal::open() {
+    lock_guard<mutex> lock(mtx_);
+    if (fd_ >= 0) return true;
+
+    fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        cerr << "[Journal] Cannot open " << path_ << ": " << strerror(errno) << "\n";
+        return false;
+    }
+
+    if (!recover()) {
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    key_ = epoch_.empty() ? source_ : source_ + "@" + epoch_;
+    cout << "[Journal] " << path_ << ": " << recovered_.size() << " records to replay\n";
+    return true;
+}
+
+void Journal::close() {
+    unique_lock<mutex> lock(mtx_);
+    syncCv_.wait(lock, [this] { return !syncing_; });
+    if (fd_ < 0) return;
+
+    fdatasync(fd_);
+    ::close(fd_);
+    fd_ = -1;
+}
+
+// Called with mtx_ held on a freshly opened fd
+bool Journal::recover() {
+    struct stat st{};
+    if (fstat(fd_, &st) != 0) return false;
+
+    if (st.st_size == 0) {
+        epoch_ = newEpoch();
+        string header = headerLine(0, epoch_);
+        if (!writeAll(fd_, header) || fdatasync(fd_) != 0) return false;
+        bytes_ = header.size();
+        return true;
+    }
+
+    string data(static_cast<size_t>(st.st_size), '\0');
+    size_t got = 0;
+    while (got < data.size()) {
+        ssize_t n = pread(fd_, &data[got], data.size() - got, static_cast<off_t>(got));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        got += static_cast<size_t>(n);
+    }
+
+    size_t eol = data.find('\n');
+    unsigned long long applied = 0;
+    char tag[8] = {};
+    char epoch[24] = {};
+    string head = eol == string::npos ? string() : data.substr(0, eol);
+    int fields = sscanf(head.c_str(), "%7s %llu %23s", tag, &applied, epoch);
+    if (fields < 2 || strcmp(tag, kHeaderTag) != 0) {
+        cerr << "[Journal] " << path_ << " is not a journal file\n";
+        return false;
+    }
+    epoch_ = fields == 3 ? epoch : "";
+    for (char c : epoch_) {
+        if (!isxdigit(static_cast<unsigned char>(c))) {
+            cerr << "[Journal] " << path_ << " has a corrupt header\n";
+            return false;
+        }
+    }
+
+    appliedSeq_ = applied;
+    lastSeq_ = applied;
+    recovered_.clear();
+
+    // Everything after the first bad line was never acknowledged as durable
+    size_t pos = eol + 1;
+    while (pos < data.size()) {
+        size_t end = data.find('\n', pos);
+        JournalRecordDTO rec;
+        if (end == string::npos || !decodeRecord(data.substr(pos, end - pos), rec) || rec.seq <= lastSeq_) {
+            cerr << "[Journal] Dropping torn tail at byte " << pos << "\n";
+            if (ftruncate(fd_, static_cast<off_t>(pos)) != 0) return false;
+            break;
+        }
+        lastSeq_ = rec.seq;
+        if (rec.seq > appliedSeq_) recovered_.push_back(std::move(rec));
+        pos = end + 1;
+    }
+
+    bytes_ = pos;
+    writtenSeq_ = durableSeq_ = lastSeq_;
+    return fdatasync(fd_) == 0;
+}
+
+/* ==================== Appends ==================== */
+
+vector<JournalRecordDTO> Journal::unapplied() const {
+    lock_guard<mutex> lock(mtx_);
+    return recovered_;
+}
+
+void Journal::reserveThrough(uint64_t seq) {
+    lock_guard<mutex> lock(mtx_);
+    if (seq <= lastSeq_) return;
+    lastSeq_ = seq;
+    writtenSeq_ = max(writtenSeq_, seq);
+    durableSeq_ = max(durableSeq_, seq);
+}
+
+bool Journal::append(JournalRecordDTO& rec) {
+    if (rec.card_id.empty() || rec.card_id.find_first_of("\t\n") != string::npos) return false;
+
+    lock_guard<mutex> lock(mtx_);
+    if (fd_ < 0) return false;
+
+    rec.seq = lastSeq_ + 1;
+    string line = encodeRecord(rec);
+
+    if (!writeAll(fd_, line)) {
+        // Never leave half a line for the next append to follow
+        if (ftruncate(fd_, static_cast<off_t>(bytes_)) != 0) {
+            cerr << "[Journal] Truncate after failed write: " << strerror(errno) << "\n";
+        }
+        rec.seq = 0;
+        return false;
+    }
+
+    lastSeq_ = writtenSeq_ = rec.seq;
+    bytes_ += line.size();
+    appended_++;
+    return true;
+}
+
+bool Journal::append(vector<JournalRecordDTO>& recs) {
+    for (const auto& rec : recs) {
+        if (rec.card_id.empty() || rec.card_id.find_first_of("\t\n") != string::npos) return false;
+    }
+
+    lock_guard<mutex> lock(mtx_);
+    if (fd_ < 0) return false;
+
+    string lines;
+    uint64_t seq = lastSeq_;
+    for (auto& rec : recs) {
+        rec.seq = ++seq;
+        lines += encodeRecord(rec);
+    }
+
+    if (!writeAll(fd_, lines)) {
+        if (ftruncate(fd_, static_cast<off_t>(bytes_)) != 0) {
+            cerr << "[Journal] Truncate after failed write: " << strerror(errno) << "\n";
+        }
+        for (auto& rec : recs) rec.seq = 0;
+        return false;
+    }
+
+    lastSeq_ = writtenSeq_ = seq;
+    bytes_ += lines.size();
+    appended_ += recs.size();
+    return true;
+}
+
+bool Journal::waitDurable(uint64_t seq) {
+    unique_lock<mutex> lock(mtx_);
+
+    while (durableSeq_ < seq) {
+        if (syncing_) {
+            syncCv_.wait(lock);
+            continue;
+        }
+        if (fd_ < 0) return false;
+
+        // Leader: one flush covers every line written before it started
+        syncing_ = true;
+        uint64_t target = writtenSeq_;
+        int fd = fd_;
+        lock.unlock();
+        bool ok = fdatasync(fd) == 0;
+        lock.lock();
+
+        syncing_ = false;
+        if (ok) {
+            durableSeq_ = max(durableSeq_, target);
+            fsyncs_++;
+        }
+        syncCv_.notify_all();
+        if (!ok) {
+            cerr << "[Journal] fdatasync failed: " << strerror(errno) << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+/* ==================== Compaction ==================== */
+
+void Journal::markApplied(uint64_t seq) {
+    unique_lock<mutex> lock(mtx_);
+    if (seq > appliedSeq_) appliedSeq_ = seq;
+    if (appliedSeq_ < lastSeq_ || bytes_ < compactBytes_ || fd_ < 0) return;
+
+    syncCv_.wait(lock, [this] { return !syncing_; });
+    if (appliedSeq_ >= lastSeq_ && !rewrite(appliedSeq_)) {
+        cerr << "[Journal] Compaction failed: " << strerror(errno) << "\n";
+    }
+}
+
+// Called with mtx_ held and nothing left to replay: swaps in a file that
+// holds only the header, via rename so a crash keeps one of the two
+bool Journal::rewrite(uint64_t appliedSeq) {
+    string tmp = path_ + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+
+    string header = headerLine(appliedSeq, epoch_);
+    if (!writeAll(fd, header) || fsync(fd) != 0 || rename(tmp.c_str(), path_.c_str()) != 0) {
+        ::close(fd);
+        unlink(tmp.c_str());
+        return false;
+    }
+    ::close(fd);
+
+    // Make the rename itself durable
+    size_t slash = path_.rfind('/');
+    string dir = slash == string::npos ? "." : (slash == 0 ? "/" : path_.substr(0, slash));
+    int dfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd >= 0) {
+        fsync(dfd);
+        ::close(dfd);
+    }
+
+    int next = ::open(path_.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+    if (next < 0) return false;
+    ::close(fd_);
+    fd_ = next;
+
+    bytes_ = header.size();
+    writtenSeq_ = durableSeq_ = lastSeq_;
+    recovered_.clear();
+    compactions_++;
+    return true;
+}
+
+/* ==================== Diagnostics ==================== */
+
+JournalStatsDTO Journal::stats() const {
+    lock_guard<mutex> lock(mtx_);
+    JournalStatsDTO s;
+    s.last_seq = lastSeq_;
+    s.applied_seq = appliedSeq_;
+    s.appended = appended_;
+    s.fsyncs = fsyncs_;
+    s.compactions = compactions_;
+    s.bytes = bytes_;
+    return s;
+}
@@ -0,0 +1,204 @@
+/* ==================== NotifyListener.cpp ==================== */
+
+#include "NotifyListener.h"
+#include "Backoff.h"
+#include <iostream>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+using namespace std;
+
+/* ==================== Trigger Definitions ==================== */
+
+// Idempotent; one generic trigger function keyed by (channel, key column)
+static const char* kNotifyTriggersSql =
+    "CREATE OR REPLACE FUNCTION nexipass_notify() RETURNS trigger AS $$ "
+    "BEGIN "
+    "  PERFORM pg_notify(TG_ARGV[0], COALESCE(to_jsonb(NEW), to_jsonb(OLD)) ->> TG_ARGV[1]); "
+    "  RETURN NULL; "
+    "END $$ LANGUAGE plpgsql; "
+    "CREATE OR REPLACE TRIGGER product_notify AFTER INSERT OR UPDATE OR DELETE ON product "
+    "  FOR EACH ROW EXECUTE FUNCTION nexipass_notify('" NOTIFY_CHANNEL_PRODUCT "', 'product_id'); "
+    "CREATE OR REPLACE TRIGGER opencard_notify AFTER INSERT OR UPDATE OR DELETE ON opencard "
+    "  FOR EACH ROW EXECUTE FUNCTION nexipass_notify('" NOTIFY_CHANNEL_CARD "', 'card_id'); "
+    "CREATE OR REPLACE TRIGGER users_notify AFTER INSERT OR UPDATE OR DELETE ON users "
+    "  FOR EACH ROW EXECUTE FUNCTION nexipass_notify('" NOTIFY_CHANNEL_USER "', 'user_id'); "
+    "CREATE OR REPLACE FUNCTION nexipass_notify_writer() RETURNS trigger AS $$ "
+    "BEGIN "
+    "  PERFORM pg_notify(TG_ARGV[0], COALESCE(current_setting('nexipass.writer', true), '')); "
+    "  RETURN NULL; "
+    "END $$ LANGUAGE plpgsql; "
+    "CREATE OR REPLACE TRIGGER producttotals_notify AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON producttotals "
+    "  FOR EACH STATEMENT EXECUTE FUNCTION nexipass_notify_writer('" NOTIFY_CHANNEL_TOTALS "');";
+
+/* ==================== Lifecycle ==================== */
+
+NotifyListener::NotifyListener(string connString)
+    : connString_(std::move(connString)), running_(false), received_(0), reconnects_(0) {
+}
+
+NotifyListener::~NotifyListener() {
+    stop();
+}
+
+void NotifyListener::subscribe(const string& channel, NotifyHandler handler) {
+    lock_guard<mutex> lock(handlersMtx_);
+    handlers_[channel].push_back(std::move(handler));
+}
+
+bool NotifyListener::start() {
+    if (running_) return true;
+
+    stopFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (stopFd_ < 0) {
+        cerr << "[Notify] Failed to create eventfd\n";
+        return false;
+    }
+
+    // The first connection is made on the listener thread, so a database
+    // that is down at startup is retried like any later drop
+    running_ = true;
+    thread_ = thread(&NotifyListener::listenLoop, this);
+    return true;
+}
+
+void NotifyListener::stop() {
+    if (running_) {
+        running_ = false;
+        uint64_t one = 1;
+        (void)write(stopFd_, &one, sizeof(one));
+        if (thread_.joinable()) thread_.join();
+    }
+
+    if (pg_ != nullptr) PQfinish(pg_);
+    pg_ = nullptr;
+    if (stopFd_ >= 0) close(stopFd_);
+    stopFd_ = -1;
+}
+
+/* ==================== Connection ==================== */
+
+bool NotifyListener::openConnection() {
+    if (pg_ != nullptr) PQfinish(pg_);
+    pg_ = PQconnectdb(connString_.c_str());
+
+    if (PQstatus(pg_) != CONNECTION_OK) return false;
+
+    PGresult* res = PQexec(pg_,
+        "LISTEN " NOTIFY_CHANNEL_PRODUCT "; "
+        "LISTEN " NOTIFY_CHANNEL_CARD "; "
+        "LISTEN " NOTIFY_CHANNEL_USER "; "
+        "LISTEN " NOTIFY_CHANNEL_TOTALS ";");
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    PQclear(res);
+
+    return ok && PQsetnonblocking(pg_, 1) == 0;
+}
+
+void NotifyListener::installTriggers() {
+    // Needs owner rights on the tables; without them we still listen for
+    // NOTIFYs raised elsewhere (e.g. by the back office)
+    PQsetnonblocking(pg_, 0);
+    PGresult* res = PQexec(pg_, kNotifyTriggersSql);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        cerr << "[Notify] Could not install triggers: " << PQerrorMessage(pg_);
+    }
+    PQclear(res);
+    PQsetnonblocking(pg_, 1);
+}
+
+/* ==================== Listener Thread ==================== */
+
+void NotifyListener::listenLoop() {
+    uint32_t failures = 0;
+    bool everConnected = false;
+
+    while (running_) {
+        if (PQstatus(pg_) != CONNECTION_OK) {
+            if (everConnected || failures > 0) {
+                if (!waitStopMs(static_cast<int>(backoffDelay(failures).count()))) break;
+            }
+
+            if (!openConnection()) {
+                failures++;
+                continue;
+            }
+            failures = 0;
+
+            if (!everConnected) {
+                installTriggers();
+                everConnected = true;
+            } else {
+                reconnects_++;
+                cout << "[Notify] Listener reconnected\n";
+            }
+            // Anything cached before this point may have missed a NOTIFY
+            dispatchResync();
+        }
+
+        pollfd fds[2]{};
+        fds[0].fd = PQsocket(pg_);
+        fds[0].events = POLLIN;
+        fds[1].fd = stopFd_;
+        fds[1].events = POLLIN;
+
+        int r = poll(fds, 2, -1);
+        if (r <= 0) continue;
+        if (fds[1].revents & POLLIN) break;
+
+        if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+            if (PQconsumeInput(pg_) == 0) {
+                // Dead socket: PQstatus(nullptr) sends us to the reconnect branch
+                PQfinish(pg_);
+                pg_ = nullptr;
+                continue;
+            }
+
+            PGnotify* n;
+            while ((n = PQnotifies(pg_)) != nullptr) {
+                DbNotification evt;
+                evt.channel = n->relname;
+                evt.payload = n->extra ? n->extra : "";
+                PQfreemem(n);
+
+                received_++;
+                dispatch(evt);
+            }
+        }
+    }
+}
+
+bool NotifyListener::waitStopMs(int ms) {
+    pollfd pfd{};
+    pfd.fd = stopFd_;
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, ms) == 0 && running_;
+}
+
+/* ==================== Dispatch ==================== */
+
+void NotifyListener::dispatch(const DbNotification& n) {
+    vector<NotifyHandler> targets;
+    {
+        lock_guard<mutex> lock(handlersMtx_);
+        auto it = handlers_.find(n.channel);
+        if (it == handlers_.end()) return;
+        targets = it->second;
+    }
+    for (auto& h : targets) h(n);
+}
+
+void NotifyListener::dispatchResync() {
+    vector<string> channels;
+    {
+        lock_guard<mutex> lock(handlersMtx_);
+        for (const auto& kv : handlers_) channels.push_back(kv.first);
+    }
+    for (const auto& c : channels) {
+        DbNotification n;
+        n.channel = c;
+        n.resync = true;
+        dispatch(n);
+    }
+}
@@ -0,0 +1,74 @@
+/* ==================== ProductCatalog.cpp ==================== */
+
+#include "ProductCatalog.h"
+#include <algorithm>
+
+using namespace std;
+
+ProductCatalog::ProductCatalog()
+    : invalidations_(1), loadedGeneration_(0), reloads_(0) {
+}
+
+/* ==================== Readers ==================== */
+
+shared_ptr<const CatalogSnapshot> ProductCatalog::peek() const {
+    return atomic_load(&current_);
+}
+
+shared_ptr<const CatalogSnapshot> ProductCatalog::get(Database& db) {
+    shared_ptr<const CatalogSnapshot> snap = atomic_load(&current_);
+    if (snap && !isStale()) return snap;
+
+    if (!snap) {
+        // Nothing to serve yet: everyone waits for the first load
+        lock_guard<mutex> lock(reloadMtx_);
+        if (!atomic_load(&current_) || isStale()) reload(db);
+        return atomic_load(&current_);
+    }
+
+    // Stale: one reader refreshes, the rest keep the previous snapshot
+    unique_lock<mutex> lock(reloadMtx_, try_to_lock);
+    if (lock.owns_lock() && isStale()) reload(db);
+    return atomic_load(&current_);
+}
+
+/* ==================== Invalidation ==================== */
+
+void ProductCatalog::invalidate() {
+    invalidations_.fetch_add(1, memory_order_acq_rel);
+}
+
+bool ProductCatalog::isStale() const {
+    return loadedGeneration_.load(memory_order_acquire) != invalidations_.load(memory_order_acquire);
+}
+
+uint64_t ProductCatalog::version() const {
+    auto snap = atomic_load(&current_);
+    return snap ? snap->version : 0;
+}
+
+/* ==================== Reload ==================== */
+
+bool ProductCatalog::reload(Database& db) {
+    // Read the generation first: a NOTIFY racing with the query leaves us stale
+    uint64_t generation = invalidations_.load(memory_order_acquire);
+
+    auto next = make_shared<CatalogSnapshot>();
+    if (db.queryProductList(next->products) != DbResult::Ok) return false;
+
+    int32_t maxId = -1;
+    for (const auto& p : next->products) maxId = max(maxId, p.product_id);
+    next->slotById.assign(static_cast<size_t>(maxId + 1), -1);
+    for (size_t i = 0; i < next->products.size(); ++i) {
+        int32_t id = next->products[i].product_id;
+        if (id >= 0) next->slotById[id] = static_cast<int32_t>(i);
+    }
+
+    auto prev = atomic_load(&current_);
+    next->version = prev ? prev->version + 1 : 1;
+
+    atomic_store(&current_, shared_ptr<const CatalogSnapshot>(std::move(next)));
+    loadedGeneration_.store(generation, memory_order_release);
+    reloads_++;
+    return true;
+}
@@ -0,0 +1,117 @@
+/* ==================== QueryStats.cpp ==================== */
+
+#include "QueryStats.h"
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+static size_t bucketOf(uint64_t us) {
+    size_t b = 0;
+    while (us != 0 && b < StatementStats::kBuckets - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/* ==================== Recording ==================== */
+
+void StatementStats::record(uint64_t us, uint32_t roundTrips, uint64_t rows, QueryError error) noexcept {
+    roundTrips_.fetch_add(roundTrips, memory_order_relaxed);
+    rows_.fetch_add(rows, memory_order_relaxed);
+    sumUs_.fetch_add(us, memory_order_relaxed);
+    buckets_[bucketOf(us)].fetch_add(1, memory_order_relaxed);
+    if (error != QueryError::None) errors_[static_cast<size_t>(error)].fetch_add(1, memory_order_relaxed);
+
+    uint64_t seen = maxUs_.load(memory_order_relaxed);
+    while (us > seen && !maxUs_.compare_exchange_weak(seen, us, memory_order_relaxed)) {
+    }
+}
+
+void StatementStats::reset() noexcept {
+    roundTrips_ = rows_ = sumUs_ = maxUs_ = 0;
+    for (auto& e : errors_) e = 0;
+    for (auto& b : buckets_) b = 0;
+}
+
+/* ==================== Snapshot ==================== */
+
+StatementStatsDTO StatementStats::snapshot(const char* name) const {
+    StatementStatsDTO s;
+    s.name = name;
+    s.round_trips = roundTrips_.load(memory_order_relaxed);
+    s.rows = rows_.load(memory_order_relaxed);
+    s.max_us = maxUs_.load(memory_order_relaxed);
+    s.errors_connection = errors_[static_cast<size_t>(QueryError::Connection)].load(memory_order_relaxed);
+    s.errors_constraint = errors_[static_cast<size_t>(QueryError::Constraint)].load(memory_order_relaxed);
+    s.errors_conflict = errors_[static_cast<size_t>(QueryError::Conflict)].load(memory_order_relaxed);
+    s.errors_other = errors_[static_cast<size_t>(QueryError::Other)].load(memory_order_relaxed);
+
+    // Percentiles from the bucket counts, so they agree with each other
+    // even while other threads keep recording
+    uint64_t counts[kBuckets];
+    uint64_t total = 0;
+    for (size_t b = 0; b < kBuckets; ++b) {
+        counts[b] = buckets_[b].load(memory_order_relaxed);
+        total += counts[b];
+    }
+    s.calls = total;
+    if (total == 0) return s;
+    s.mean_us = sumUs_.load(memory_order_relaxed) / total;
+
+    auto percentile = [&](double q) -> uint64_t {
+        double rank = q * static_cast<double>(total);
+        uint64_t below = 0;
+        for (size_t b = 0; b < kBuckets; ++b) {
+            if (counts[b] == 0 || static_cast<double>(below + counts[b]) < rank) {
+                below += counts[b];
+                continue;
+            }
+            if (b == 0) return 0;
+            double lo = static_cast<double>(uint64_t(1) << (b - 1));
+            double hi = lo * 2.0;
+            double v = lo + (hi - lo) * (rank - static_cast<double>(below)) / static_cast<double>(counts[b]);
+            uint64_t us = static_cast<uint64_t>(v);
+            return us < s.max_us ? us : s.max_us;
+        }
+        return s.max_us;
+    };
+
+    s.p50_us = percentile(0.50);
+    s.p90_us = percentile(0.90);
+    s.p99_us = percentile(0.99);
+    return s;
+}
+
+/* ==================== Result Classification ==================== */
+
+QueryError classifyResult(const PGconn* pg, const PGresult* res) noexcept {
+    if (res == nullptr) return QueryError::Connection;
+
+    switch (PQresultStatus(res)) {
+        case PGRES_COMMAND_OK:
+        case PGRES_TUPLES_OK:
+        case PGRES_SINGLE_TUPLE:
+        case PGRES_COPY_IN:
+        case PGRES_COPY_OUT:
+        case PGRES_EMPTY_QUERY:
+            return QueryError::None;
+        default:
+            break;
+    }
+
+    const char* state = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+    if (state == nullptr || strncmp(state, "08", 2) == 0) return QueryError::Connection;
+    if (pg != nullptr && PQstatus(pg) != CONNECTION_OK) return QueryError::Connection;
+    if (strncmp(state, "23", 2) == 0) return QueryError::Constraint;
+    if (strncmp(state, "40", 2) == 0 || strcmp(state, "55P03") == 0) return QueryError::Conflict;
+    return QueryError::Other;
+}
+
+uint64_t resultRows(const PGresult* res) noexcept {
+    if (res == nullptr) return 0;
+    if (PQresultStatus(res) == PGRES_TUPLES_OK) return static_cast<uint64_t>(PQntuples(res));
+    const char* affected = PQcmdTuples(const_cast<PGresult*>(res));
+    return *affected ? strtoull(affected, nullptr, 10) : 0;
+}
@@ -0,0 +1,175 @@
+/* ==================== ReplicaPool.cpp ==================== */
+
+#include "ReplicaPool.h"
+#include "Backoff.h"
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+// Seconds the replica's replayed state trails the primary. A replica that
+// has replayed everything it received is current even if the primary has
+// been idle (and the last replayed commit is old).
+static const char* kLagSql =
+    "SELECT CASE "
+    "  WHEN NOT pg_is_in_recovery() THEN 0 "
+    "  WHEN pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() THEN 0 "
+    "  ELSE COALESCE(EXTRACT(EPOCH FROM now() - pg_last_xact_replay_timestamp()), 0) "
+    "END";
+
+/* ==================== Lifecycle ==================== */
+
+ReplicaPool::ReplicaPool(string connString, size_t connections, chrono::milliseconds maxLag,
+                         function<bool(PGconn*)> init)
+    : connString_(std::move(connString)), nConns_(connections > 0 ? connections : 1),
+      init_(std::move(init)), maxLag_(maxLag), usable_(false), lagMs_(-1),
+      reads_(0), fallbacks_(0), reconnects_(0) {
+}
+
+ReplicaPool::~ReplicaPool() {
+    close();
+}
+
+bool ReplicaPool::open(PGconn*& pg) {
+    if (pg == nullptr) {
+        pg = PQconnectdb(connString_.c_str());
+    } else {
+        PQreset(pg);
+    }
+    return PQstatus(pg) == CONNECTION_OK && (!init_ || init_(pg));
+}
+
+bool ReplicaPool::connect() {
+    lock_guard<mutex> lock(mtx_);
+    if (!conns_.empty()) return !down_;
+
+    conns_.assign(nConns_, nullptr);
+    bool up = true;
+    for (PGconn*& pg : conns_) up = open(pg) && up;
+
+    free_.clear();
+    for (size_t i = conns_.size(); i-- > 0;) free_.push_back(i);
+
+    int64_t lag = -1;
+    if (up) up = measureLag(conns_.front(), lag);
+
+    down_ = !up;
+    lagMs_ = lag;
+    usable_ = up && lag <= maxLag_.count();
+    retryAt_ = chrono::steady_clock::now();
+    if (!up) cerr << "[Replica] Unreachable, reads stay on the primary\n";
+    return up;
+}
+
+void ReplicaPool::close() {
+    unique_lock<mutex> lock(mtx_);
+    usable_ = false;
+    cv_.wait(lock, [this] { return free_.size() == conns_.size(); });
+    for (PGconn* pg : conns_) {
+        if (pg != nullptr) PQfinish(pg);
+    }
+    conns_.clear();
+    free_.clear();
+}
+
+/* ==================== Leases ==================== */
+
+PGconn* ReplicaPool::acquire(chrono::milliseconds timeout) {
+    if (!usable_) {
+        fallbacks_++;
+        return nullptr;
+    }
+
+    unique_lock<mutex> lock(mtx_);
+    bool ready = cv_.wait_for(lock, timeout, [this] { return !free_.empty() || !usable_; });
+    if (!ready || !usable_) {
+        fallbacks_++;
+        return nullptr;
+    }
+
+    PGconn* pg = conns_[free_.back()];
+    free_.pop_back();
+    reads_++;
+    return pg;
+}
+
+void ReplicaPool::release(PGconn* pg) {
+    bool broken = PQstatus(pg) != CONNECTION_OK;
+    {
+        lock_guard<mutex> lock(mtx_);
+        size_t slot = static_cast<size_t>(find(conns_.begin(), conns_.end(), pg) - conns_.begin());
+        free_.push_back(slot);
+
+        // Stop routing here until the supervisor has reset it
+        if (broken) {
+            down_ = true;
+            usable_ = false;
+            retryAt_ = chrono::steady_clock::now();
+        }
+    }
+    cv_.notify_all();
+}
+
+/* ==================== Supervision ==================== */
+
+bool ReplicaPool::measureLag(PGconn* pg, int64_t& lagMs) {
+    PGresult* res = PQexec(pg, kLagSql);
+    bool ok = PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 1;
+    if (ok) lagMs = static_cast<int64_t>(strtod(PQgetvalue(res, 0, 0), nullptr) * 1000.0);
+    PQclear(res);
+    return ok;
+}
+
+void ReplicaPool::probe() {
+    vector<size_t> slots;
+    {
+        // Take every idle connection; busy ones are checked on release
+        lock_guard<mutex> lock(mtx_);
+        if (conns_.empty()) return;
+        if (down_ && chrono::steady_clock::now() < retryAt_) return;
+        slots.swap(free_);
+    }
+    if (slots.empty()) return;
+
+    bool wasDown;
+    {
+        lock_guard<mutex> lock(mtx_);
+        wasDown = down_;
+    }
+
+    bool up = true;
+    for (size_t slot : slots) {
+        PGconn*& pg = conns_[slot];
+        if (PQstatus(pg) != CONNECTION_OK || wasDown) up = open(pg) && up;
+    }
+
+    int64_t lag = -1;
+    if (up) up = measureLag(conns_[slots.front()], lag);
+
+    {
+        lock_guard<mutex> lock(mtx_);
+        for (size_t slot : slots) free_.push_back(slot);
+
+        if (up) {
+            if (wasDown) {
+                reconnects_++;
+                cerr << "[Replica] Back, lag " << lag << " ms\n";
+            }
+            down_ = false;
+            failures_ = 0;
+        } else {
+            down_ = true;
+            retryAt_ = chrono::steady_clock::now() + backoffDelay(failures_);
+            failures_++;
+        }
+
+        lagMs_ = up ? lag : -1;
+        bool nowUsable = up && lag <= maxLag_.count();
+        if (up && !nowUsable && usable_) {
+            cerr << "[Replica] " << lag << " ms behind, reads move to the primary\n";
+        }
+        usable_ = nowUsable;
+    }
+    cv_.notify_all();
+}
@@ -0,0 +1,260 @@
+/* ==================== Schema.cpp ==================== */
+
+#include "Schema.h"
+#include <iostream>
+#include <cstdlib>
+#include <string>
+
+using namespace std;
+
+/* ==================== Migration Registry ==================== */
+
+struct MigrationDef {
+    int version;
+    const char* description;
+    const char* sql;
+};
+
+// Append only: a shipped migration is never edited, a change is a new
+// version. Every step tolerates objects a hand-built database already has.
+static const MigrationDef kMigrations[] = {
+    // The tables the statement registry assumes. line_total is computed by
+    // Postgres, which is why the inserts never send it. No foreign keys on
+    // the sale tables: each would add a lookup and a row lock on the
+    // referenced product to every consumption.
+    { 1, "base tables",
+      "CREATE TABLE IF NOT EXISTS users ("
+      "  user_id serial PRIMARY KEY, "
+      "  username text NOT NULL, "
+      "  password_hash text NOT NULL, "
+      "  role text NOT NULL DEFAULT 'EMPLOYEE'"
+      "); "
+      "CREATE TABLE IF NOT EXISTS product ("
+      "  product_id serial PRIMARY KEY, "
+      "  product_name text NOT NULL, "
+      "  price_unit numeric(10,2) NOT NULL"
+      "); "
+      "CREATE TABLE IF NOT EXISTS opencard ("
+      "  card_id text PRIMARY KEY, "
+      "  status char(1) NOT NULL DEFAULT 'D', "
+      "  phone integer NOT NULL DEFAULT 0, "
+      "  total_to_pay numeric(12,2) NOT NULL DEFAULT 0"
+      "); "
+      "CREATE TABLE IF NOT EXISTS openconsumption ("
+      "  id_consumption bigserial PRIMARY KEY, "
+      "  card_id text NOT NULL, "
+      "  product_id integer NOT NULL, "
+      "  employee_id integer NOT NULL, "
+      "  qty integer NOT NULL, "
+      "  price_unit numeric(10,2) NOT NULL, "
+      "  line_total numeric(12,2) GENERATED ALWAYS AS (qty * price_unit) STORED"
+      "); "
+      "CREATE TABLE IF NOT EXISTS producttotals ("
+      "  product_id integer NOT NULL, "
+      "  employee_id integer NOT NULL, "
+      "  qty_total bigint NOT NULL DEFAULT 0, "
+      "  line_total numeric(14,2) NOT NULL DEFAULT 0, "
+      "  PRIMARY KEY (product_id, employee_id)"
+      ")" },
+
+    // Per-terminal replay position of the card journal
+    { 2, "journal cursor",
+      "CREATE TABLE IF NOT EXISTS journalcursor ("
+      "  source text PRIMARY KEY, "
+      "  last_seq bigint NOT NULL DEFAULT 0"
+      ")" },
+
+    // Keys the hot paths rely on, created only where no equivalent index
+    // exists (tables from migration 1 already have most of them):
+    //   openconsumption(card_id)  summary lines, running total, checkout DELETE
+    //   opencard(card_id)         every FOR UPDATE card lock, import ON CONFLICT
+    //   producttotals(product_id, employee_id)  checkout ON CONFLICT target
+    //   users(username)           login
+    // A unique build fails on duplicate rows, which those statements could
+    // not run against anyway. opencard is updated on every sale but its
+    // indexed column never changes, so free page space keeps those updates
+    // HOT; openconsumption churns (insert, then delete at checkout) and is
+    // vacuumed early.
+    { 3, "hot-path indexes and storage",
+      "DO $$ "
+      "DECLARE ix record; "
+      "BEGIN "
+      "  FOR ix IN SELECT * FROM (VALUES "
+      "      ('openconsumption', 'card_id', 'openconsumption_card_id_idx', false), "
+      "      ('opencard', 'card_id', 'opencard_card_id_key', true), "
+      "      ('producttotals', 'product_id, employee_id', 'producttotals_product_employee_key', true), "
+      "      ('users', 'username', 'users_username_key', true) "
+      "  ) AS v(tbl, cols, name, uniq) LOOP "
+      "    IF NOT EXISTS ("
+      "      SELECT 1 FROM pg_index i "
+      "      WHERE i.indrelid = ix.tbl::regclass AND i.indpred IS NULL "
+      "        AND (i.indisunique OR NOT ix.uniq) "
+      "        AND (SELECT string_agg(a.attname, ', ' ORDER BY k.ord) "
+      "             FROM unnest(i.indkey::int2[]) WITH ORDINALITY AS k(attnum, ord) "
+      "             JOIN pg_attribute a ON a.attrelid = i.indrelid AND a.attnum = k.attnum) = ix.cols"
+      "    ) THEN "
+      "      EXECUTE format('CREATE %s INDEX %I ON %I (%s)', "
+      "                     CASE WHEN ix.uniq THEN 'UNIQUE' ELSE '' END, ix.name, ix.tbl, ix.cols); "
+      "    END IF; "
+      "  END LOOP; "
+      "END $$; "
+      "ALTER TABLE opencard SET (fillfactor = 70); "
+      "ALTER TABLE openconsumption SET (autovacuum_vacuum_scale_factor = 0.05, "
+      "                                 autovacuum_analyze_scale_factor = 0.05)" },
+
+    // Sales over time. Checkout moves each consumption line, stamped with
+    // when it was rung up, into salehistory (append-only, one partition per
+    // month, BRIN on the timestamp) and adds it to the per-minute rollup
+    // salesminute, whose key leads with the bucket so a window is one
+    // index range. Partitions are created ahead by
+    // nexipass_sale_partitions(); the default partition catches the rest.
+    { 4, "sales history",
+      "ALTER TABLE openconsumption ADD COLUMN IF NOT EXISTS consumed_at timestamptz NOT NULL DEFAULT now(); "
+      "CREATE TABLE IF NOT EXISTS salehistory ("
+      "  sold_at timestamptz NOT NULL, "
+      "  card_id text NOT NULL, "
+      "  product_id integer NOT NULL, "
+      "  employee_id integer NOT NULL, "
+      "  qty integer NOT NULL, "
+      "  line_total numeric(12,2) NOT NULL"
+      ") PARTITION BY RANGE (sold_at); "
+      "CREATE TABLE IF NOT EXISTS salehistory_default PARTITION OF salehistory DEFAULT; "
+      "CREATE INDEX IF NOT EXISTS salehistory_sold_at_brin ON salehistory USING brin (sold_at); "
+      "CREATE TABLE IF NOT EXISTS salesminute ("
+      "  bucket timestamptz NOT NULL, "
+      "  product_id integer NOT NULL, "
+      "  employee_id integer NOT NULL, "
+      "  qty_total bigint NOT NULL DEFAULT 0, "
+      "  line_total numeric(14,2) NOT NULL DEFAULT 0, "
+      "  PRIMARY KEY (bucket, product_id, employee_id)"
+      "); "
+      // SECURITY DEFINER so a backend without DDL rights can still roll
+      // partitions forward; a range already holding rows in the default
+      // partition is skipped rather than failing the caller
+      "CREATE OR REPLACE FUNCTION nexipass_sale_partitions(months_ahead integer) RETURNS integer "
+      "LANGUAGE plpgsql SECURITY DEFINER SET search_path FROM CURRENT AS $$ "
+      "DECLARE m date; part text; made integer := 0; "
+      "BEGIN "
+      "  FOR i IN 0..months_ahead LOOP "
+      "    m := (date_trunc('month', now()) + make_interval(months => i))::date; "
+      "    part := 'salehistory_' || to_char(m, 'YYYYMM'); "
+      "    CONTINUE WHEN to_regclass(part) IS NOT NULL; "
+      "    BEGIN "
+      "      EXECUTE format('CREATE TABLE %I PARTITION OF salehistory FOR VALUES FROM (%L) TO (%L)', "
+      "                     part, m, (m + interval '1 month')::date); "
+      "      made := made + 1; "
+      "    EXCEPTION WHEN others THEN "
+      "      RAISE NOTICE 'salehistory partition % skipped: %', part, SQLERRM; "
+      "    END; "
+      "  END LOOP; "
+      "  RETURN made; "
+      "END $$; "
+      "SELECT nexipass_sale_partitions(2)" },
+};
+
+static const int kMigrationCount = static_cast<int>(sizeof(kMigrations) / sizeof(kMigrations[0]));
+
+// Arbitrary, shared by every NexiPass binary
+static const char* kMigrationLockSql = "SELECT pg_advisory_xact_lock(7866218354019)";
+
+/* ==================== Helpers ==================== */
+
+static bool execCommand(PGconn* pg, const char* sql) {
+    PGresult* res = PQexec(pg, sql);
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK || PQresultStatus(res) == PGRES_TUPLES_OK;
+    if (!ok) cerr << "[Schema] " << PQerrorMessage(pg);
+    PQclear(res);
+    return ok;
+}
+
+// 0 when schemaversion does not exist yet, -1 on error
+static int recordedVersion(PGconn* pg) {
+    PGresult* res = PQexec(pg, "SELECT to_regclass('schemaversion') IS NOT NULL");
+    if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) != 1) {
+        PQclear(res);
+        return -1;
+    }
+    bool exists = PQgetvalue(res, 0, 0)[0] == 't';
+    PQclear(res);
+    if (!exists) return 0;
+
+    res = PQexec(pg, "SELECT COALESCE(MAX(version), 0) FROM schemaversion");
+    int version = -1;
+    if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 1) version = atoi(PQgetvalue(res, 0, 0));
+    PQclear(res);
+    return version;
+}
+
+static bool rollback(PGconn* pg) {
+    PGresult* res = PQexec(pg, "ROLLBACK");
+    PQclear(res);
+    return false;
+}
+
+/* ==================== Migration Runner ==================== */
+
+int schemaLatestVersion() noexcept {
+    return kMigrations[kMigrationCount - 1].version;
+}
+
+bool migrateSchema(PGconn* pg, SchemaStatusDTO& out) noexcept {
+    try {
+        out = SchemaStatusDTO{};
+
+        // Common case: nothing to do, and no lock or DDL rights needed
+        int version = recordedVersion(pg);
+        if (version < 0) {
+            cerr << "[Schema] Cannot read schema version: " << PQerrorMessage(pg);
+            return false;
+        }
+        out.found = out.version = version;
+        if (version >= schemaLatestVersion()) return true;
+
+        if (!execCommand(pg, "BEGIN")) return false;
+        if (!execCommand(pg, kMigrationLockSql) ||
+            !execCommand(pg, "CREATE TABLE IF NOT EXISTS schemaversion ("
+                             "  version integer PRIMARY KEY, "
+                             "  description text NOT NULL, "
+                             "  applied_at timestamptz NOT NULL DEFAULT now()"
+                             ")")) {
+            return rollback(pg);
+        }
+
+        // Another terminal may have migrated while we waited for the lock
+        version = recordedVersion(pg);
+        if (version < 0) return rollback(pg);
+        out.found = version;
+
+        for (const MigrationDef& m : kMigrations) {
+            if (m.version <= version) continue;
+
+            if (!execCommand(pg, m.sql)) {
+                cerr << "[Schema] Migration " << m.version << " (" << m.description << ") failed\n";
+                return rollback(pg);
+            }
+
+            string v = to_string(m.version);
+            const char* params[2] = { v.c_str(), m.description };
+            PGresult* res = PQexecParams(pg,
+                "INSERT INTO schemaversion (version, description) VALUES ($1::int, $2)",
+                2, nullptr, params, nullptr, nullptr, 0);
+            bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+            PQclear(res);
+            if (!ok) return rollback(pg);
+
+            out.applied++;
+        }
+
+        if (!execCommand(pg, "COMMIT")) return rollback(pg);
+        out.version = schemaLatestVersion();
+
+        if (out.applied > 0) {
+            cout << "[Schema] Migrated " << out.found << " -> " << out.version
+                 << " (" << out.applied << " steps)\n";
+        }
+        return true;
+
+    } catch (...) {
+        return false;
+    }
+}
@@ -0,0 +1,152 @@
+/* ==================== TotalsCache.cpp ==================== */
+
+#include "TotalsCache.h"
+#include "ProductCatalog.h"
+#include <algorithm>
+
+using namespace std;
+
+TotalsCache::TotalsCache()
+    : invalidations_(1), loadedGeneration_(0), reloads_(0), folds_(0), version_(0) {
+}
+
+/* ==================== Readers ==================== */
+
+void TotalsCache::copyTo(vector<TotalsRowDTO>& out) const {
+    lock_guard<mutex> lock(mtx_);
+    out.clear();
+    out.reserve(rows_.size());
+    for (const auto& kv : rows_) out.push_back(kv.second);
+}
+
+DbResult TotalsCache::get(Database& db, vector<TotalsRowDTO>& out) {
+    bool loaded;
+    {
+        lock_guard<mutex> lock(mtx_);
+        loaded = loaded_;
+    }
+
+    if (loaded && !isStale()) {
+        copyTo(out);
+        return DbResult::Ok;
+    }
+
+    if (!loaded) {
+        // Nothing to serve yet: everyone waits for the seed
+        lock_guard<mutex> lock(reloadMtx_);
+        return reload(db, out);
+    }
+
+    // Stale: one reader reseeds, the rest serve the folded map meanwhile
+    unique_lock<mutex> lock(reloadMtx_, try_to_lock);
+    if (lock.owns_lock() && isStale()) return reload(db, out);
+    copyTo(out);
+    return DbResult::Ok;
+}
+
+/* ==================== Incremental Updates ==================== */
+
+void TotalsCache::fold(const vector<TotalsRowDTO>& deltas, const CatalogSnapshot* cat) {
+    if (deltas.empty()) return;
+
+    bool namesMissing = false;
+    {
+        lock_guard<mutex> lock(mtx_);
+        for (const TotalsRowDTO& d : deltas) {
+            auto key = make_pair(d.product_id, d.employee_id);
+            auto it = rows_.find(key);
+
+            if (it == rows_.end()) {
+                // First sale of this product by this employee
+                TotalsRowDTO row;
+                row.product_id = d.product_id;
+                row.employee_id = d.employee_id;
+                if (const ProductDTO* p = cat ? cat->find(d.product_id) : nullptr) {
+                    row.product_name = p->name;
+                } else {
+                    namesMissing = true;
+                }
+
+                auto same = find_if(rows_.begin(), rows_.end(), [&](const auto& kv) {
+                    return kv.first.second == d.employee_id;
+                });
+                if (same != rows_.end()) {
+                    row.employee_username = same->second.employee_username;
+                } else {
+                    namesMissing = true;
+                }
+                it = rows_.emplace(key, std::move(row)).first;
+            }
+
+            it->second.qty_total += d.qty_total;
+            it->second.line_total += d.line_total;
+        }
+        version_.fetch_add(1, memory_order_acq_rel);
+    }
+
+    folds_++;
+    if (namesMissing) invalidate();
+}
+
+void TotalsCache::beginCheckout() {
+    lock_guard<mutex> lock(mtx_);
+    checkoutsInFlight_++;
+    checkoutsBegun_++;
+}
+
+void TotalsCache::endCheckout() {
+    lock_guard<mutex> lock(mtx_);
+    if (checkoutsInFlight_ > 0) checkoutsInFlight_--;
+}
+
+/* ==================== Invalidation ==================== */
+
+void TotalsCache::invalidate() {
+    invalidations_.fetch_add(1, memory_order_acq_rel);
+}
+
+bool TotalsCache::isStale() const {
+    return loadedGeneration_.load(memory_order_acquire) != invalidations_.load(memory_order_acquire);
+}
+
+/* ==================== Reload ==================== */
+
+// Called with reloadMtx_ held. The reader always gets the rows it queried;
+// they only replace the map if no checkout was in flight at any point while
+// the query ran (one committed just before the snapshot would otherwise be
+// folded in on top of it) and nothing invalidated the cache meanwhile.
+DbResult TotalsCache::reload(Database& db, vector<TotalsRowDTO>& out) {
+    uint64_t generation = invalidations_.load(memory_order_acquire);
+    bool busy;
+    uint64_t begun;
+    {
+        lock_guard<mutex> lock(mtx_);
+        busy = checkoutsInFlight_ > 0;
+        begun = checkoutsBegun_;
+    }
+
+    vector<TotalsRowDTO> fresh;
+    DbResult r = db.queryTotals(fresh);
+
+    lock_guard<mutex> lock(mtx_);
+    if (r != DbResult::Ok) {
+        if (!loaded_) return r;
+        // Postgres unreachable: keep serving what was folded in
+        out.clear();
+        for (const auto& kv : rows_) out.push_back(kv.second);
+        return DbResult::Ok;
+    }
+
+    bool overlapped = busy || checkoutsBegun_ != begun;
+    if (!overlapped && invalidations_.load(memory_order_acquire) == generation) {
+        rows_.clear();
+        for (const auto& row : fresh) rows_.emplace(make_pair(row.product_id, row.employee_id), row);
+        loaded_ = true;
+        loadedGeneration_.store(generation, memory_order_release);
+        reloads_++;
+        version_.fetch_add(1, memory_order_acq_rel);
+    }
+
+    out = std::move(fresh);
+    return DbResult::Ok;
+}
@@ -0,0 +1,266 @@
+/* ==================== WebSocket.cpp ==================== */
+
+#include "WebSocket.h"
+#include <cstring>
+#include <strings.h>
+#include <cerrno>
+#include <cctype>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+using namespace std;
+
+namespace ws {
+
+static const char* kAcceptGuid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+/* ==================== SHA-1 / Base64 ==================== */
+
+// Only for Sec-WebSocket-Accept, which RFC 6455 fixes to SHA-1
+static void sha1(const string& msg, uint8_t digest[20]) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+    string data = msg;
+    uint64_t bits = static_cast<uint64_t>(msg.size()) * 8;
+    data += static_cast<char>(0x80);
+    while (data.size() % 64 != 56) data += '\0';
+    for (int i = 7; i >= 0; --i) data += static_cast<char>((bits >> (i * 8)) & 0xFF);
+
+    auto rol = [](uint32_t v, int n) { return (v << n) | (v >> (32 - n)); };
+
+    for (size_t chunk = 0; chunk < data.size(); chunk += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i) {
+            const uint8_t* p = reinterpret_cast<const uint8_t*>(data.data() + chunk + i * 4);
+            w[i] = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+        }
+        for (int i = 16; i < 80; ++i) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+            uint32_t t = rol(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rol(b, 30); b = a; a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+
+    for (int i = 0; i < 5; ++i) {
+        digest[i * 4] = static_cast<uint8_t>(h[i] >> 24);
+        digest[i * 4 + 1] = static_cast<uint8_t>(h[i] >> 16);
+        digest[i * 4 + 2] = static_cast<uint8_t>(h[i] >> 8);
+        digest[i * 4 + 3] = static_cast<uint8_t>(h[i]);
+    }
+}
+
+static string base64(const uint8_t* data, size_t len) {
+    static const char* table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    string out;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = uint32_t(data[i]) << 16;
+        if (i + 1 < len) v |= uint32_t(data[i + 1]) << 8;
+        if (i + 2 < len) v |= data[i + 2];
+        out += table[(v >> 18) & 0x3F];
+        out += table[(v >> 12) & 0x3F];
+        out += i + 1 < len ? table[(v >> 6) & 0x3F] : '=';
+        out += i + 2 < len ? table[v & 0x3F] : '=';
+    }
+    return out;
+}
+
+/* ==================== Socket I/O ==================== */
+
+static bool readAll(int fd, void* buf, size_t len) {
+    uint8_t* p = static_cast<uint8_t*>(buf);
+    while (len > 0) {
+        ssize_t n = ::recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/* ==================== Handshake ==================== */
+
+// Case-insensitive header lookup in a raw request head
+static string headerValue(const string& head, const char* name) {
+    size_t nameLen = strlen(name);
+    size_t pos = head.find("\r\n");
+    while (pos != string::npos && pos + 2 < head.size()) {
+        size_t start = pos + 2;
+        size_t end = head.find("\r\n", start);
+        if (end == string::npos) end = head.size();
+        if (end - start > nameLen && head[start + nameLen] == ':' &&
+            strncasecmp(head.c_str() + start, name, nameLen) == 0) {
+            size_t v = start + nameLen + 1;
+            while (v < end && isspace(static_cast<unsigned char>(head[v]))) v++;
+            size_t e = end;
+            while (e > v && isspace(static_cast<unsigned char>(head[e - 1]))) e--;
+            return head.substr(v, e - v);
+        }
+        pos = end;
+    }
+    return {};
+}
+
+static void setRecvTimeout(int fd, chrono::milliseconds timeout) {
+    timeval tv{};
+    tv.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+    tv.tv_usec = static_cast<suseconds_t>((timeout.count() % 1000) * 1000);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+static bool containsToken(string value, const char* token) {
+    for (char& c : value) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return value.find(token) != string::npos;
+}
+
+bool acceptHandshake(int fd, string& path, chrono::milliseconds timeout) {
+    auto deadline = chrono::steady_clock::now() + timeout;
+    string head;
+    char buf[512];
+    while (head.find("\r\n\r\n") == string::npos) {
+        if (head.size() > 8192) return false;
+        // Re-armed with what is left, so a trickling peer is bounded too
+        auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+        if (left.count() <= 0) return false;
+        setRecvTimeout(fd, left);
+        ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        head.append(buf, static_cast<size_t>(n));
+    }
+    // A client may not send frames before the 101, so nothing is lost here
+    head.resize(head.find("\r\n\r\n"));
+    // Upgraded sessions block in reads for as long as the tablet is idle
+    setRecvTimeout(fd, chrono::milliseconds(0));
+
+    string key = headerValue(head, "Sec-WebSocket-Key");
+    bool upgrade = head.compare(0, 4, "GET ") == 0 && !key.empty() &&
+                   containsToken(headerValue(head, "Upgrade"), "websocket") &&
+                   containsToken(headerValue(head, "Connection"), "upgrade");
+    if (!upgrade) {
+        static const char* reject = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\nContent-Length: 0\r\n\r\n";
+        writeAll(fd, reject, strlen(reject));
+        return false;
+    }
+
+    size_t sp = head.find(' ', 4);
+    path = head.substr(4, sp == string::npos ? string::npos : sp - 4);
+    size_t q = path.find('?');
+    if (q != string::npos) path.resize(q);
+
+    uint8_t digest[20];
+    sha1(key + kAcceptGuid, digest);
+    string reply = "HTTP/1.1 101 Switching Protocols\r\n"
+                   "Upgrade: websocket\r\n"
+                   "Connection: Upgrade\r\n"
+                   "Sec-WebSocket-Accept: " + base64(digest, sizeof(digest)) + "\r\n\r\n";
+    return writeAll(fd, reply.data(), reply.size());
+}
+
+/* ==================== Frames ==================== */
+
+bool writeFrame(int fd, Opcode op, const char* data, size_t len) {
+    char head[10];
+    size_t headLen = 2;
+    head[0] = static_cast<char>(0x80 | static_cast<uint8_t>(op));
+    if (len < 126) {
+        head[1] = static_cast<char>(len);
+    } else if (len <= 0xFFFF) {
+        head[1] = 126;
+        head[2] = static_cast<char>(len >> 8);
+        head[3] = static_cast<char>(len);
+        headLen = 4;
+    } else {
+        head[1] = 127;
+        for (int i = 0; i < 8; ++i) head[2 + i] = static_cast<char>(static_cast<uint64_t>(len) >> ((7 - i) * 8));
+        headLen = 10;
+    }
+    return writeAll(fd, head, headLen) && writeAll(fd, data, len);
+}
+
+bool readMessage(int fd, string& out, Opcode& op, const FrameWriter& write) {
+    out.clear();
+    bool inMessage = false;
+
+    while (true) {
+        uint8_t hdr[2];
+        if (!readAll(fd, hdr, 2)) return false;
+
+        bool fin = (hdr[0] & 0x80) != 0;
+        Opcode frameOp = static_cast<Opcode>(hdr[0] & 0x0F);
+        // Clients must mask, and no extension is negotiated
+        if ((hdr[1] & 0x80) == 0 || (hdr[0] & 0x70) != 0) return false;
+
+        uint64_t len = hdr[1] & 0x7F;
+        if (len == 126) {
+            uint8_t ext[2];
+            if (!readAll(fd, ext, 2)) return false;
+            len = (uint64_t(ext[0]) << 8) | ext[1];
+        } else if (len == 127) {
+            uint8_t ext[8];
+            if (!readAll(fd, ext, 8)) return false;
+            // RFC 6455 5.2: the most significant bit must be 0
+            if (ext[0] & 0x80) return false;
+            len = 0;
+            for (int i = 0; i < 8; ++i) len = (len << 8) | ext[i];
+        }
+
+        // Compared against what is left, so a huge length cannot wrap the sum
+        bool control = (static_cast<uint8_t>(frameOp) & 0x8) != 0;
+        if (control ? (len > 125 || !fin) : len > kMaxMessage - out.size()) return false;
+
+        uint8_t mask[4];
+        if (!readAll(fd, mask, 4)) return false;
+
+        string payload(static_cast<size_t>(len), '\0');
+        if (len > 0 && !readAll(fd, &payload[0], payload.size())) return false;
+        for (size_t i = 0; i < payload.size(); ++i) payload[i] = static_cast<char>(payload[i] ^ mask[i % 4]);
+
+        switch (frameOp) {
+            case Opcode::Ping:
+                if (!write(Opcode::Pong, payload.data(), payload.size())) return false;
+                continue;
+            case Opcode::Pong:
+                continue;
+            case Opcode::Close:
+                write(Opcode::Close, payload.data(), payload.size() >= 2 ? 2 : 0);
+                return false;
+            case Opcode::Text:
+            case Opcode::Binary:
+                if (inMessage) return false;
+                inMessage = true;
+                op = frameOp;
+                break;
+            case Opcode::Continuation:
+                if (!inMessage) return false;
+                break;
+            default:
+                return false;
+        }
+
+        out += payload;
+        if (fin) return true;
+    }
+}
+
+} // namespace ws
@@ -2,6 +2,8 @@
 
 #include <iostream>
 #include <string>
+#include <cstdlib>
+#include <stdexcept>
 #include <csignal>
 #include <unistd.h>
 #include <poll.h>
@@ -9,7 +11,10 @@
 #include <pthread.h>
 
 #include "Database.h"
+#include "CardStore.h"
+#include "Journal.h"
 #include "FeedbackController.h"
+#include "EventHub.h"
 #include "CardService.h"
 #include "ApiController.h"
 
@@ -41,6 +46,21 @@ static int make_signalfd_for_shutdown() {
 int main(int argc, char** argv) {
     std::string db_host = (argc > 1) ? argv[1] : "192.168.1.156";
     std::string connStr = "host=" + db_host + " port=5432 dbname=Nexipass user=postgres password=1234";
+    size_t poolSize = 4;   // One connection per Pi core
+    std::string journalPath = (argc > 3) ? argv[3] : "/var/lib/nexipass/card.journal";
+    std::string replicaHost = (argc > 4) ? argv[4] : "";
+
+    if (argc > 2) {
+        try {
+            size_t used = 0;
+            poolSize = std::stoul(argv[2], &used);
+            if (argv[2][0] == '-' || used != std::string(argv[2]).size() || poolSize == 0) throw std::invalid_argument("pool_size");
+        } catch (const std::exception&) {
+            std::cerr << "[FATAL] Invalid pool_size '" << argv[2] << "'\n"
+                      << "Usage: " << argv[0] << " [db_host] [pool_size] [journal_path] [replica_host]\n";
+            return 1;
+        }
+    }
 
     std::cout << "--- NexiPass RT System (3-Thread Architecture) ---\n";
 
@@ -49,18 +69,52 @@ int main(int argc, char** argv) {
 
     /* ==================== Database Connection ==================== */
 
-    Database db(connStr);
+    Database db(connStr, poolSize);
+    if (!replicaHost.empty()) {
+        db.setReadReplica("host=" + replicaHost + " port=5432 dbname=Nexipass user=postgres password=1234");
+    }
     if (db.connect() != DbResult::Ok) {
         std::cerr << "[FATAL] Failed to connect to database\n";
         close(sfd);
         return 1;
     }
+    std::cout << "[DB] Connection pool ready (" << poolSize << " connections)\n";
+    db.startSupervisor();
+    db.enableCatalogCache();
+    db.enableTotalsCache();
+
+    // Sales keep flowing through a Postgres outage: writes land in the
+    // local journal first and are replayed once the database is back
+    char host[64] = {};
+    gethostname(host, sizeof(host) - 1);
+    Journal journal(journalPath, std::string("pos-") + host);
+    bool journaled = journal.open();
+    if (!journaled) {
+        std::cerr << "[WARN] Journal unavailable, card writes are held in memory only\n";
+    }
+
+    // Card status/totals served from memory, persisted write-behind
+    CardStore cardStore(db, journaled ? &journal : nullptr);
+    cardStore.start();
+    db.startListener();
+    // Opt-in binary result decoding, e.g. NEXIPASS_BINARY_RESULTS=1
+    const char* binary = std::getenv("NEXIPASS_BINARY_RESULTS");
+    db.setBinaryResults(binary != nullptr && std::string(binary) == "1");
+
+    // CardService queries are multiplexed over non-blocking connections
+    if (db.startAsync(2) != DbResult::Ok) {
+        std::cerr << "[WARN] Async engine unavailable, using blocking pool only\n";
+    }
 
     /* ==================== System Initialization ==================== */
 
     FeedbackController feedback;
     CardService cardService(&db, &feedback);
+    cardService.useCardStore(&cardStore, WriteAck::Journaled);
+    EventHub events;
+    cardService.useEventHub(&events);
     ApiController app(&db, &cardService, &feedback);
+    app.useEventHub(&events);
 
     app.start();
     std::cout << "[System] Running. Awaiting SIGINT/SIGTERM...\n";
@@ -90,6 +144,11 @@ int main(int argc, char** argv) {
     std::cout << "[System] Stopping threads...\n";
     app.stop();
 
+    // Flush queued card writes; the listener must not outlive the store
+    db.stopListener();
+    cardStore.stop();
+    journal.close();
+
     close(sfd);
     std::cout << "[System] Shutdown complete.\n";
     return 0;
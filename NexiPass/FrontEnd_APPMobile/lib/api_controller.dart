@@ -126,6 +126,59 @@ Future<Map<String, dynamic>> addConsumptionWithDebug(int productId, int quantity
   }
 }
 //***********************************************************************************************************/
+//                                          ADD CONSUMPTIONS (cart) Debug                                   //
+//***********************************************************************************************************/
+
+// Whole order in one request; the backend applies every line or none
+Future<Map<String, dynamic>> addConsumptionsWithDebug(List<Map<String, int>> items) async {
+  String debugInfo = '';
+
+  if (currentCardId == null) {
+    debugInfo = 'ERRO: currentCardId é null!';
+    return {'success': false, 'debug': debugInfo};
+  }
+
+  if (currentUserId == null) {
+    debugInfo = 'ERRO: currentUserId é null!';
+    return {'success': false, 'debug': debugInfo};
+  }
+
+  try {
+    debugInfo += '========== DEBUG ADD CONSUMPTIONS ==========\n';
+    debugInfo += 'URL: $_baseUrl/add_consumptions\n';
+    debugInfo += 'Card ID: $currentCardId\n';
+    debugInfo += 'Items: $items\n';
+    debugInfo += 'Employee ID: $currentUserId\n';
+    debugInfo += 'A enviar pedido...\n\n';
+
+    final resp = await http.post(
+      Uri.parse('$_baseUrl/add_consumptions'),
+      headers: {'Content-Type': 'application/json'},
+      body: jsonEncode({
+        'card_id': currentCardId,
+        'employee_id': currentUserId,
+        'items': items,
+      }),
+    );
+
+    debugInfo += 'Status Code: ${resp.statusCode}\n';
+    debugInfo += 'Response Body: ${resp.body}\n';
+
+    if (resp.statusCode != 200) {
+      return {'success': false, 'debug': debugInfo};
+    }
+
+    final data = jsonDecode(resp.body);
+    bool success = data['ok'] == true;
+
+    return {'success': success, 'debug': debugInfo};
+
+  } catch (e) {
+    debugInfo += '\nERRO: $e';
+    return {'success': false, 'debug': debugInfo};
+  }
+}
+//***********************************************************************************************************/
 //***********************************************************************************************************/
 //                                          Validate Exit Debug                                             //
 //***********************************************************************************************************/
@@ -176,16 +229,22 @@ Future<Map<String, dynamic>> validateExitWithDebug() async {
 
 
 
+  // Long-poll: the server holds the request until a card newer than
+  // _lastScanSeq is scanned, or answers null after ~25s
+  int _lastScanSeq = 0;
+
   Future<String?> waitForCard() async {
     try {
       final resp = await http.get(
-        Uri.parse('$_baseUrl/wait_card'),
+        Uri.parse('$_baseUrl/wait_card?timeout=25000&after=$_lastScanSeq'),
       );
 
       if (resp.statusCode != 200) return null;
 
       final data = jsonDecode(resp.body);
       final id = data['card_id'] as String?;
+      final seq = data['seq'];
+      if (seq is int) _lastScanSeq = seq;
 
       if (id != null) {
         currentCardId = id;
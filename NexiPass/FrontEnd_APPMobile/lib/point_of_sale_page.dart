@@ -313,23 +313,14 @@ Future<void> _confirmAdd(BuildContext context) async {
     builder: (_) => const Center(child: CircularProgressIndicator()),
   );
 
-  bool allOk = true;
-  String allDebugInfo = '';
-
-  for (final item in selected) {
-    final result = await api.addConsumptionWithDebug(
-      item.product.id,
-      item.quantity,
-    );
-
-    allDebugInfo += result['debug'] as String;
-    allDebugInfo += '\n-------------------\n';
-
-    if (!(result['success'] as bool)) {
-      allOk = false;
-      break;
-    }
-  }
+  // One request and one transaction for the whole order
+  final result = await api.addConsumptionsWithDebug([
+    for (final item in selected)
+      {'product_id': item.product.id, 'quantity': item.quantity},
+  ]);
+
+  final bool allOk = result['success'] as bool;
+  final String allDebugInfo = result['debug'] as String;
 
   Navigator.of(context).pop(); // fecha loading
 